@@ -248,7 +248,9 @@ int main(int argc, char **argv) {
 	}
 
 	config.tmp_pch_abs = concat(tmp, "/" DOARR_PRECOMPILED);
-	if(!config.tmp_pch_abs) {
+	config.tmp_generic_cxx_abs = concat(tmp, "/" DOARR_GENERIC ".cpp");
+	config.tmp_generic_o_abs = concat(tmp, "/" DOARR_GENERIC ".o");
+	if(!config.tmp_pch_abs || !config.tmp_generic_cxx_abs || !config.tmp_generic_o_abs) {
 		dcc_oom(), status = 1;
 		goto rm_tmp;
 	}
@@ -4,6 +4,7 @@
 #include <sys/types.h>
 
 #define DOARR_PRECOMPILED "doarr__precompiled"
+#define DOARR_GENERIC "doarr__generic"
 
 #if __STDC_VERSION__ >= 201112L
 #define noreturn _Noreturn
@@ -57,13 +58,15 @@ struct config {
 	struct compiler_arg *compiler_args;
 	int num_compiler_args;
 	const char *output;
-	bool compile, preproc, nowarn, verbose, invalid;
+	bool compile, preproc, nowarn, verbose, generic, invalid;
 
 	struct tool tools[NumTools];
 
 	int dev_null;
 	int tmp_fd;
 	const char *tmp_pch_abs;
+	const char *tmp_generic_cxx_abs;
+	const char *tmp_generic_o_abs;
 };
 
 enum { TmpOutputNameLen = 64 };
@@ -74,7 +77,7 @@ void dcc_parse_args(char **argp, struct config *config, struct input_file *out_i
 
 // dcc_scan.c
 
-char *dcc_scan_up_to_next_export(FILE *in);
+char *dcc_scan_up_to_next_export(FILE *in, bool *out_generic);
 
 // dcc_gen.c
 
@@ -10,6 +10,7 @@
 #include <unistd.h>
 
 #include "dcc.h"
+#include "../runtime/digest.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -33,13 +34,24 @@ static const char generated_file_prolog[] =
 static const char generated_file_fn_entry[] =
 	"#ifndef doarr__seen_%2$i_%1$s\n"
 	"#define doarr__seen_%2$i_%1$s\n"
+	"extern int (*const doarr__generic_%2$i_%1$s)(const void *, unsigned long) __attribute__((weak));\n" // only defined with -c
 	"const struct guest_fn %1$s = {\n"
 	" .file = &doarr__file_%2$i,\n"
 	" .name = \"%1$s\",\n"
+	" .generic = &doarr__generic_%2$i_%1$s,\n"
 	"};\n"
 	"#endif\n"
 	"\n"
 ;
+static const char generic_file_prolog[] =
+	"// generated code, consider not modifying!\n"
+	"\n"
+	"#include \"%s\"\n"
+	"\n"
+;
+static const char generic_file_fn_entry[] =
+	"extern \"C\" int (*const doarr__generic_%2$i_%1$s)(const void *, unsigned long) = doarr::internal::generic_entry<&%1$s>::value;\n"
+;
 static const char generated_file_epilog[] =
 	"\n"
 	"static struct guest_file doarr__file_%i = {\n"
@@ -48,11 +60,43 @@ static const char generated_file_epilog[] =
 	" .compiler_args = doarr__compiler_args,\n"
 	" .num_compiler_args = sizeof doarr__compiler_args / sizeof *doarr__compiler_args,\n"
 	" .pos_between_args = %i,\n"
+	" .source_path = doarr__source_path_%i,\n"
+	" .source_digest = {{0x%llxull, 0x%llxull}},\n"
 	"};\n"
 ;
 
-static bool generate_c_part1(FILE *out, int file_index, FILE *in, const char *const *compiler_args, bool *have_any_functions) {
-	char *ident = dcc_scan_up_to_next_export(in);
+static void write_c_string(FILE *out, const char *s) {
+	fputc('\"', out);
+	for(const char *p = s; *p; p++) {
+		if(*p == '?' && p[1] == '?')
+			fputs("?\"\"", out);
+		else if(*p == '\"' || *p == '\\')
+			fputc('\\', out), fputc(*p, out);
+		else if(*p >= 32 && *p < 127)
+			fputc(*p, out);
+		else
+			fprintf(out, "\\x%02x", (unsigned) (unsigned char) *p);
+	}
+	fputc('\"', out);
+}
+
+// the runtime only uses the source (instead of the precompiled header) while it still has this digest
+static bool digest_source(const char *source_path, struct doarr_digest *out_digest) {
+	const void *data;
+	size_t size;
+	if(!dcc_map(AT_FDCWD, source_path, &data, &size))
+		return false;
+	doarr_digest_init(out_digest);
+	doarr_digest_update(out_digest, size ? data : "", size);
+	dcc_unmap(data, size);
+	return true;
+}
+
+// generic_out (if not null) receives the definitions of generic fallbacks, to be compiled as C++
+// source_path is the absolute path of the input (empty if unknown), for the runtime to fall back to when the precompiled header does not match its flags
+static bool generate_c_part1(FILE *out, FILE *generic_out, int file_index, FILE *in, const char *const *compiler_args, const char *source_path, bool *have_any_functions) {
+	bool generic;
+	char *ident = dcc_scan_up_to_next_export(in, &generic);
 	if(!ident) { // null = error
 		return false;
 	}
@@ -67,10 +111,12 @@ static bool generate_c_part1(FILE *out, int file_index, FILE *in, const char *co
 		_Pragma("GCC diagnostic push");
 		_Pragma("GCC diagnostic ignored \"-Wformat\"");
 		fprintf(out, generated_file_fn_entry, ident, file_index);
+		if(generic_out && generic)
+			fprintf(generic_out, generic_file_fn_entry, ident, file_index);
 		_Pragma("GCC diagnostic pop");
 		free(ident);
 
-		ident = dcc_scan_up_to_next_export(in);
+		ident = dcc_scan_up_to_next_export(in, &generic);
 		if(!ident) // null = error
 			return false;
 	} while(*ident); // "" = clean eof
@@ -81,37 +127,32 @@ static bool generate_c_part1(FILE *out, int file_index, FILE *in, const char *co
 		"static const char *const doarr__compiler_args[] = {\n"
 	, out);
 	for(const char * const*argp = compiler_args; *argp; argp++) {
-		fputs(" \"", out);
-		for(const char *p = *argp; *p; p++) {
-			if(*p == '?' && p[1] == '?')
-				fputs("?\"\"", out);
-			else if(*p == '\"' || *p == '\\')
-				fputc('\\', out), fputc(*p, out);
-			else if(*p >= 32 && *p < 127)
-				fputc(*p, out);
-			else
-				fprintf(out, "\\x%02x", (unsigned) (unsigned char) *p);
-		}
-		fputs("\",", out);
+		fputc(' ', out);
+		write_c_string(out, *argp);
+		fputc(',', out);
 	}
 	fputs("\n};\n#endif\n", out);
 
+	fprintf(out, "static const char doarr__source_path_%i[] = ", file_index);
+	write_c_string(out, source_path);
+	fputs(";\n", out);
+
 	*have_any_functions = true;
 	return true;
 }
 
-static void generate_c_part2_bin(FILE *out, int file_index, size_t data_size, int pos_between_args) {
+static void generate_c_part2_bin(FILE *out, int file_index, size_t data_size, int pos_between_args, const struct doarr_digest *source_digest) {
 	static const char data_symbol[] = "_binary_"DOARR_PRECOMPILED"_start";
 	fprintf(out, "\nextern const unsigned char %s[];\n", data_symbol);
-	fprintf(out, generated_file_epilog, file_index, data_symbol, data_symbol, data_size, pos_between_args);
+	fprintf(out, generated_file_epilog, file_index, data_symbol, data_symbol, data_size, pos_between_args, file_index, source_digest->lanes[0], source_digest->lanes[1]);
 }
 
-static void generate_c_part2_txt(FILE *out, int file_index, const unsigned char *data, size_t data_size, int pos_between_args) {
+static void generate_c_part2_txt(FILE *out, int file_index, const unsigned char *data, size_t data_size, int pos_between_args, const struct doarr_digest *source_digest) {
 	static const char data_symbol_f[] = DOARR_PRECOMPILED"_%i";
 	char data_symbol[sizeof data_symbol_f + 3 * sizeof file_index];
 	sprintf(data_symbol, data_symbol_f, file_index);
 	fprintf(out, "\nstatic const unsigned char %s[%zu];\n", data_symbol, data_size); // tentative definition
-	fprintf(out, generated_file_epilog, file_index, data_symbol, data_symbol, data_size, pos_between_args);
+	fprintf(out, generated_file_epilog, file_index, data_symbol, data_symbol, data_size, pos_between_args, file_index, source_digest->lanes[0], source_digest->lanes[1]);
 	fprintf(out, "\nstatic const unsigned char %s[%zu] = \"\\\n", data_symbol, data_size);
 	enum {
 		bytes_per_line = 32, // bytes of input
@@ -142,6 +183,7 @@ static void generate_c_part2_txt(FILE *out, int file_index, const unsigned char
 static const char *const common_opts[] = {"-shared", "-fPIC", "-fvisibility=hidden", "-O3"};
 static const char *const export_finder_opts[] = {"-E", "-P", "-x" "c++-header"};
 static const char *const precompiler_opts[] = {"-x" "c++-header"};
+static const char *const generic_opts[] = {"-c"};
 
 static size_t zmax(size_t a, size_t b) {
 	return a > b ? a : b;
@@ -152,7 +194,7 @@ static size_t max_cxx_args(const struct config *config) {
 		+ 1   // program name
 		+ 1   // const char *argv1, const char *argv2
 		+ LEN(common_opts)
-		+ zmax(LEN(export_finder_opts), LEN(precompiler_opts)) // one of them gets passed as specific_opts
+		+ zmax(zmax(LEN(export_finder_opts), LEN(precompiler_opts)), LEN(generic_opts)) // one of them gets passed as specific_opts
 		+ (config->num_compiler_args + 1)  // compiler_args, with the input_file.name mixed inbetween them
 		+ 1   // terminating null pointer
 	;
@@ -237,6 +279,25 @@ static pid_t start_precompiler(const struct config *config, struct input_file fi
 	return pid;
 }
 
+static pid_t start_generic_compiler(const struct config *config, struct input_file file, const char **arg_buff) {
+	bool discard_stderr = !config->verbose;
+	struct input_file generic_file = {
+		.name = config->tmp_generic_cxx_abs,
+		.pos_between_opts = file.pos_between_opts,
+	};
+	pid_t pid = fork();
+	switch(pid) {
+		case Child:
+			if(discard_stderr && dup2(config->dev_null, STDERR_FILENO) < 0)
+				dcc_perror(RT_ERR "generic dup2 stderr"), _exit(127);
+			exec_cxx(config, "-o", config->tmp_generic_o_abs, /*common opts,*/ generic_opts, LEN(generic_opts), generic_file, arg_buff);
+		case Err:
+			dcc_perror(RT_ERR "generic fork");
+			return Err;
+	}
+	return pid;
+}
+
 static pid_t start_preprocessor(const struct config *config, struct input_file file, const char **arg_buff, FILE **out_out_file) {
 	bool discard_stderr = !config->verbose;
 	enum { ReadEnd, WriteEnd };
@@ -278,11 +339,17 @@ static bool process_single_file(const struct config *config, int file_index, str
 	static const char tmp_pch[] = DOARR_PRECOMPILED;
 	static const char tmp_c[] = "tmp.c";
 	static const char tmp_o[] = "tmp.o";
+	static const char tmp_generic_cxx[] = DOARR_GENERIC ".cpp";
+	static const char tmp_generic_o[] = DOARR_GENERIC ".o";
+	static const char tmp_pch_o[] = DOARR_PRECOMPILED ".o";
 
 	pid_t precompiler_pid = -1;
 	pid_t preprocessor_pid = -1;
+	pid_t generic_pid = -1;
 	FILE *c_file = NULL;
+	FILE *generic_file = NULL;
 	FILE *preprocessor_output = NULL;
+	bool have_generic = false;
 
 	precompiler_pid = start_precompiler(config, file, arg_buff, config->tmp_pch_abs);
 	if(precompiler_pid < 0)
@@ -296,15 +363,48 @@ static bool process_single_file(const struct config *config, int file_index, str
 	const char *c_file_name = config->preproc ? out_filename : tmp_c;
 	c_file = dcc_fopenat(config->tmp_fd, c_file_name, O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC|O_NOFOLLOW, 0400);
 
+	if(config->compile && config->generic) {
+		// the generic fallbacks are compiled from a file that includes the input by its absolute path
+		char *abs_name = realpath(file.name, NULL);
+		if(abs_name && !strpbrk(abs_name, "\"\\\n")) {
+			generic_file = dcc_fopenat(config->tmp_fd, tmp_generic_cxx, O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC|O_NOFOLLOW, 0400);
+			if(generic_file)
+				fprintf(generic_file, generic_file_prolog, abs_name);
+		}
+		free(abs_name);
+	}
+
 	bool have_any_functions;
 
 	int pos_between_rt_args = file.pos_between_opts;
 	build_runtime_args(config, arg_buff, &pos_between_rt_args);
 	if(config->verbose)
 		dcc_err_a("Runtime compiler args:", arg_buff);
-	if(!generate_c_part1(c_file, file_index, preprocessor_output, arg_buff, &have_any_functions))
+	char *source_path = realpath(file.name, NULL);
+	struct doarr_digest source_digest = {{0, 0}};
+	if(source_path && !digest_source(source_path, &source_digest)) {
+		free(source_path);
+		source_path = NULL;
+	}
+	bool part1_ok = generate_c_part1(c_file, generic_file, file_index, preprocessor_output, arg_buff, source_path ? source_path : "", &have_any_functions);
+	free(source_path);
+	if(!part1_ok)
 		goto error;
 
+	if(generic_file) {
+		bool err = ferror(generic_file) | fclose(generic_file);
+		generic_file = NULL;
+		if(err) {
+			dcc_errf(RT_ERR "error writing '%s'", tmp_generic_cxx);
+			goto error;
+		}
+		if(have_any_functions) {
+			generic_pid = start_generic_compiler(config, file, arg_buff);
+			if(generic_pid < 0)
+				goto error;
+		}
+	}
+
 	if(!dcc_wait(&preprocessor_pid, "preprocessor"))
 		goto error;
 
@@ -320,6 +420,7 @@ static bool process_single_file(const struct config *config, int file_index, str
 
 		if(!dcc_unlink(config->tmp_fd, tmp_pch))
 			goto error;
+		dcc_unlink_if_ex(config->tmp_fd, tmp_generic_cxx);
 
 		if(config->preproc)
 			return true;
@@ -344,7 +445,7 @@ static bool process_single_file(const struct config *config, int file_index, str
 			goto error;
 		if(!dcc_unlink(config->tmp_fd, tmp_pch))
 			goto error;
-		generate_c_part2_txt(c_file, file_index, data, size, pos_between_rt_args);
+		generate_c_part2_txt(c_file, file_index, data, size, pos_between_rt_args, &source_digest);
 		dcc_unmap(data, size);
 	} else {
 		struct stat statbuf;
@@ -352,7 +453,7 @@ static bool process_single_file(const struct config *config, int file_index, str
 			dcc_perror_s(RT_ERR "fstatat", tmp_pch);
 			goto error;
 		}
-		generate_c_part2_bin(c_file, file_index, statbuf.st_size, pos_between_rt_args);
+		generate_c_part2_bin(c_file, file_index, statbuf.st_size, pos_between_rt_args, &source_digest);
 	}
 
 	if(true) {
@@ -378,10 +479,39 @@ static bool process_single_file(const struct config *config, int file_index, str
 	if(!dcc_unlink(config->tmp_fd, tmp_c))
 		goto error;
 
+	if(generic_pid != -1) {
+		// the fallbacks are optional, so their failure is only a warning (rerun with -v to see why)
+		have_generic = dcc_wait(&generic_pid, "generic compiler");
+		if(!have_generic && !config->nowarn)
+			dcc_errf("warning: could not precompile generic fallbacks for '%s'", file.name);
+		if(!dcc_unlink(config->tmp_fd, tmp_generic_cxx))
+			goto error;
+	}
+
 	if(!run_tool(config, ToolLD, (const char *[]) {
 		TBA "ld", "-r",
-		tmp_o,
 		"-b" "binary", tmp_pch,
+		"-o", tmp_pch_o,
+		NULL,
+	})) goto error;
+
+	if(!dcc_unlink(config->tmp_fd, tmp_pch))
+		goto error;
+
+	// page-aligned and read-only, so that the runtime can copy it straight from the executable file (see copy_from_image in io.c)
+	if(!run_tool(config, ToolObjcopy, (const char *[]) {
+		TBA "objcopy",
+		"--rename-section", ".data=.rodata." DOARR_PRECOMPILED ",alloc,load,readonly,data,contents",
+		"--set-section-alignment", ".data=4096", // matched before renaming
+		tmp_pch_o,
+		NULL,
+	})) goto error;
+
+	if(!run_tool(config, ToolLD, (const char *[]) {
+		TBA "ld", "-r",
+		tmp_o,
+		have_generic ? tmp_generic_o : "/dev/null",
+		tmp_pch_o,
 		"-o", out_filename,
 		"-z" "noexecstack",
 		NULL,
@@ -389,11 +519,14 @@ static bool process_single_file(const struct config *config, int file_index, str
 
 	if(!dcc_unlink(config->tmp_fd, tmp_o))
 		goto error;
-	if(!dcc_unlink(config->tmp_fd, tmp_pch))
+	if(!dcc_unlink(config->tmp_fd, tmp_pch_o))
 		goto error;
+	dcc_unlink_if_ex(config->tmp_fd, tmp_generic_o);
 
+	// the guest code linked in with the fallbacks is all hidden, make it local so that it cannot clash with other guests
 	if(!run_tool(config, ToolObjcopy, (const char *[]) {
 		TBA "objcopy",
+		"--localize-hidden",
 		"-L" "_binary_"DOARR_PRECOMPILED"_start",
 		"-N" "_binary_"DOARR_PRECOMPILED"_end",
 		"-N" "_binary_"DOARR_PRECOMPILED"_size",
@@ -408,15 +541,22 @@ error:
 	dcc_errf("error while processing '%s'", file.name);
 	if(c_file)
 		fclose(c_file);
+	if(generic_file)
+		fclose(generic_file);
 	if(preprocessor_output)
 		fclose(preprocessor_output);
 	if(preprocessor_pid != -1)
 		dcc_wait(&preprocessor_pid, "preprocessor");
 	if(precompiler_pid != -1)
 		dcc_wait(&precompiler_pid, "precompiler");
+	if(generic_pid != -1)
+		dcc_wait(&generic_pid, "generic compiler");
 	dcc_unlink_if_ex(config->tmp_fd, tmp_pch);
 	dcc_unlink_if_ex(config->tmp_fd, tmp_c);
 	dcc_unlink_if_ex(config->tmp_fd, tmp_o);
+	dcc_unlink_if_ex(config->tmp_fd, tmp_generic_cxx);
+	dcc_unlink_if_ex(config->tmp_fd, tmp_generic_o);
+	dcc_unlink_if_ex(config->tmp_fd, tmp_pch_o);
 	dcc_unlink_if_ex(config->tmp_fd, out_filename);
 	return false;
 }
@@ -81,6 +81,14 @@ static void set_nowarn(struct opt_action_param p) {
 	forward(p);
 }
 
+static void set_generic(struct opt_action_param p) {
+	p.config->generic = true;
+}
+
+static void set_no_generic(struct opt_action_param p) {
+	p.config->generic = false;
+}
+
 static void set_verbose(struct opt_action_param p) {
 	p.config->verbose = true;
 	forward(p);
@@ -160,6 +168,9 @@ const struct option_key option_keys[] = {
 	{"-Wl,", Immediate}, {"-Xlinker", Separate, "linker option", forward},
 	{"-Wa,", Immediate}, {"-Xassembler", Separate, "assembler option", forward},
 	{0},
+	{"-fdoarr-generic", NoArg, "also precompile generic fallbacks (which must be linkable into the host)", set_generic},
+	{"-fno-doarr-generic", NoArg, "do not precompile generic fallbacks (the default)", set_no_generic},
+	{0},
 	{"-help", Immediate}, {"--help", Immediate, "display help", help_and_exit},
 };
 #pragma GCC diagnostic pop
@@ -205,6 +216,11 @@ static void help(void) {
 	puts("be slow to process later (although runtime is not affected).");
 	puts("As such, '-E' should be preferred over '-c'.");
 	puts("");
+	puts("With '-c', each exported function that is not a template");
+	puts("is also compiled as is, to be run while its specializations");
+	puts("are being compiled at runtime. This requires that the guest");
+	puts("code can be linked into the host program.");
+	puts("");
 	puts("Most other C++ compiler options may be used as well.");
 	puts("They are generally just forwarded to the C++ compiler.");
 	puts("");
@@ -112,10 +112,43 @@ static char *scan_ident(FILE *in) {
 	}
 }
 
-char *dcc_scan_up_to_next_export(FILE *in) {
+// Skips the parameter list (after the opening paren) and reports whether it is free of auto parameters (abbreviated templates).
+static bool scan_params(FILE *in, bool *out_no_auto) {
+	*out_no_auto = true;
+	int depth = 1;
+	for(int curr, prev = ' ';;) {
+		switch(curr = fgetc(in)) {
+			case EOF:
+				report_eof(in);
+				return false;
+			case '"':
+				scan_string(in);
+				break;
+			case '(':
+				depth++;
+				break;
+			case ')':
+				if(!--depth)
+					return true;
+				break;
+			case 'a':
+				if(char_is_ident(prev)) break;
+				if(!scan_exactly(in, (const uchar *) "uto", 3)) break;
+				curr = fgetc(in);
+				ungetc(curr, in);
+				if(!char_is_ident(curr))
+					*out_no_auto = false;
+				curr = 'o';
+				break;
+		}
+		prev = curr;
+	}
+}
+
+char *dcc_scan_up_to_next_export(FILE *in, bool *out_generic) {
 	static const uchar doarr[] = "doarr";
 	static const uchar exported[] = "exported";
-	for(int curr, prev = ' ';;) {
+	for(int curr, prev = ' ', prev_printable = ' ';;) {
 		switch(curr = fgetc(in)) {
 			case EOF:
 				if(ferror(in)) {
@@ -126,18 +159,20 @@ char *dcc_scan_up_to_next_export(FILE *in) {
 				}
 			case '"':
 				scan_string(in);
-				prev = '"';
+				prev = prev_printable = '"';
 				continue;
 			case 'R':
 				if(fgetc(in) == '"') {
 					scan_raw_string(in);
-					prev = '"';
+					prev = prev_printable = '"';
 				} else {
-					prev = 'R';
+					prev = prev_printable = 'R';
 				}
 				continue;
 			case 'd':
 				if(char_is_ident(prev)) continue;
+				// a template can only be precompiled once instantiated
+				*out_generic = prev_printable != '>';
 				if(!scan_exactly(in, doarr + 1, sizeof doarr - 2)) continue;
 				if(scan_first_printable(in) != ':') continue;
 				if(scan_first_printable(in) != ':') continue;
@@ -156,9 +191,17 @@ char *dcc_scan_up_to_next_export(FILE *in) {
 					free(ident);
 					return NULL;
 				}
+				bool no_auto;
+				if(!scan_params(in, &no_auto)) {
+					free(ident);
+					return NULL;
+				}
+				*out_generic &= no_auto;
 				return ident;
 			default:
 				prev = curr;
+				if(curr > ' ')
+					prev_printable = curr;
 				continue;
 		}
 	}
@@ -3,4 +3,5 @@
 struct guest_fn {
 	void *const file; // points to struct guest_file
 	const char *const name;
+	int (*const *const generic)(const void *args, unsigned long num_args); // null if not precompiled, points to null if not applicable
 };
@@ -15,6 +15,12 @@ union any {
 	void *p;
 };
 
+// a dynamic value together with its member of `any` ('i', 'f' or 'p'), passed to generic fallbacks
+struct tagged_any {
+	any value;
+	char tag;
+};
+
 }
 
 #endif
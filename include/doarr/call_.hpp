@@ -2,12 +2,21 @@
 #define DOARR_CALL_HPP_
 
 /*
- * Function called by import.hpp header-only types and defined in call.cpp.
+ * Functions called by import.hpp header-only types and defined in call.cpp.
  */
 
 #include "expr_base.hpp"
+#include "specialization.hpp"
 
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <exception>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 namespace doarr {
 
@@ -19,12 +28,167 @@ namespace internal {
 struct guest_fn {
 	void *const file; // points to C struct guest_file
 	const char *const name;
+	int (*const *const generic)(const void *args, unsigned long num_args); // see generic_entry in export.hpp
 };
 
+struct compiler_options;
+
+void set_compiler_options(const guest_fn *fn, std::string_view flags);
+
 void call(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args);
+specialization_future compile_async(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args);
+// is_slot has an element for each of call_args
+bound_base bind(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args, const bool *is_slot);
+
+template<typename Bound, typename... Args>
+struct bound_for {
+	using type = Bound;
+};
+
+template<typename... Ts, typename Arg, typename... Args>
+struct bound_for<bound<Ts...>, Arg, Args...> : bound_for<bound<Ts...>, Args...> {};
+
+template<typename... Ts, typename Arg, typename... Args> requires requires { typename Arg::slot_value_type; }
+struct bound_for<bound<Ts...>, Arg, Args...> : bound_for<bound<Ts..., typename Arg::slot_value_type>, Args...> {};
+
+// doarr::bound taking the values for the slots among Args
+template<typename... Args>
+using bound_for_t = typename bound_for<bound<>, std::remove_cvref_t<Args>...>::type;
+
+template<typename... Args>
+bound_for_t<Args...> bind(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, Args &&... args) {
+	const bool is_slot[] = {requires { typename std::remove_cvref_t<Args>::slot_value_type; }..., false};
+	return bound_for_t<Args...>(bind(fn, have_tmpl_args, std::move(tmpl_args), exprs{decltype(args)(args).to_expr()...}, is_slot));
+}
+
+}
+
+// a specialization to be compiled ahead of time, see prepare_all
+class request {
+	const internal::guest_fn *fn;
+	bool have_tmpl_args;
+	exprs tmpl_args;
+	exprs call_args;
+
+public:
+	explicit request(const internal::guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args) noexcept :
+		fn(fn), have_tmpl_args(have_tmpl_args), tmpl_args(std::move(tmpl_args)), call_args(std::move(call_args)) {}
+	request(request &&) noexcept = default;
+
+	friend void prepare_all(std::vector<request> &&requests);
+	friend void fuse(std::vector<request> &&requests);
+	friend std::size_t autotune(std::vector<request> &&candidates, unsigned warmup, unsigned repetitions);
+};
 
+// compiles all the requested specializations concurrently, returns once all of them are ready (or throws the first error)
+void prepare_all(std::vector<request> &&requests);
+
+template<std::same_as<request>... Requests>
+void prepare_all(Requests &&... requests) {
+	std::vector<request> v;
+	v.reserve(sizeof...(requests));
+	(..., v.push_back(std::move(requests)));
+	prepare_all(std::move(v));
 }
 
+// Runs the requested calls in order, as one specialization generated from a single source (so that the compiler can inline them into each other).
+// The dynamic values are taken from the requests. The first function's flags apply (see set_compiler_options) and its guest file is the one included
+// by its precompiled header. The other guest files must have been given the same flags by dcc, their sources are then included by their paths.
+void fuse(std::vector<request> &&requests);
+
+template<std::same_as<request>... Requests>
+void fuse(Requests &&... requests) {
+	std::vector<request> v;
+	v.reserve(sizeof...(requests));
+	(..., v.push_back(std::move(requests)));
+	fuse(std::move(v));
+}
+
+// Returns the index of the fastest of the requested calls, usually the same function with different static arguments (e.g. block sizes).
+// They are compiled concurrently, then each runs warmup times and is timed over repetitions runs (by the median), with its dynamic values as the workload.
+// Candidates that fail to compile are left out, unless all of them do. The winner is remembered for the same specializations and CPU model,
+// in the persistent cache if enabled (see DOARR_CACHE_DIR), and then returned without compiling or running anything.
+std::size_t autotune(std::vector<request> &&candidates, unsigned warmup = 3, unsigned repetitions = 15);
+
+template<std::same_as<request>... Requests>
+std::size_t autotune(Requests &&... candidates) {
+	std::vector<request> v;
+	v.reserve(sizeof...(candidates));
+	(..., v.push_back(std::move(candidates)));
+	return autotune(std::move(v));
+}
+
+// Sets up the runtime (the scratch directory, the process that removes it at exit and the compiler launcher), otherwise done on first use.
+// Best called early, while the process is still small, as the helper processes are forked from it. DOARR_EARLY_INIT=1 does it at load time.
+// Throws std::runtime_error on failure.
+void init();
+
+// Extra compiler flags for the specializations (e.g. "-O2 -march=native"), separated by whitespace.
+// They go after those given to dcc, so they can override them. The same call compiled with different flags is a different specialization.
+// The flags in effect are the global ones (initially DOARR_CXXFLAGS), then those of the function (see imported::set_compiler_options),
+// then those of the compiler_options_scope objects of the thread that looks the specialization up.
+// Flags that the embedded precompiled header does not match (e.g. -march, -ffast-math, -O0 or -g) make the compiler parse the guest source instead,
+// which is slower and needs the source unchanged at the path it had for dcc. The compiler warns when it does (-Wno-invalid-pch silences it).
+void set_compiler_options(std::string_view flags);
+
+// Adds compiler flags (see above) for the specializations looked up by this thread (by calls, bind, compile_async and prepare_all) while it exists.
+// Scopes nest and must be destroyed in the reverse order.
+class compiler_options_scope {
+	const internal::compiler_options *outer;
+
+public:
+	explicit compiler_options_scope(std::string_view flags);
+	compiler_options_scope(const compiler_options_scope &) = delete;
+	void operator =(const compiler_options_scope &) = delete;
+	~compiler_options_scope();
+};
+
+// Limits the loaded specializations (0 = unlimited, the default unless DOARR_CACHE_MAX_MODULES and DOARR_CACHE_MAX_BYTES are set).
+// When exceeded, the least recently used shared libraries are unloaded. Those with live handles (see specialization.hpp) are kept.
+void set_cache_budget(std::size_t max_modules, std::size_t max_bytes);
+
+// A specialization called by imported::operator() this many times in a row with some of its dynamic integers always the same (among the first 8 dynamic values)
+// gets a variant with those values as literals, compiled in the background. Then the calls with these values run the variant, the others run it as before.
+// The calls are profiled in consecutive windows of this many, from when the specialization is compiled until the first window that yields a variant.
+// 0 disables it (the default is DOARR_PROFILE_CALLS, or 0).
+void set_value_profiling(std::size_t calls) noexcept;
+
+struct cache_stats {
+	std::size_t modules; // loaded shared libraries (each contains one or more specializations)
+	std::size_t bytes; // mapped by them
+	std::size_t evictions; // specializations unloaded so far
+	std::size_t reloads; // specializations compiled (or loaded from DOARR_CACHE_DIR) again soon after their eviction
+};
+
+cache_stats get_cache_stats();
+
+struct specialization_stats {
+	static constexpr std::size_t num_buckets = 40;
+
+	std::string function; // the call it was compiled for, with the dynamic values as DOARR_EXPORT[<index>]
+	const char *state; // "compiling", "ready" or "failed"
+	double compile_seconds; // wall time to compile (or load from DOARR_CACHE_DIR) the batch it was in
+	bool from_disk_cache;
+	std::size_t module_bytes; // mapped by the shared library it is in
+	std::size_t module_specializations; // in the same shared library
+
+	// only counted while enabled, see set_stats_enabled (and only for calls through imported::operator())
+	std::uint64_t hits, misses; // whether the call found it ready
+	std::uint64_t fallback_calls; // misses that ran the generic fallback
+	std::uint64_t overhead_ns_hist[num_buckets]; // calls (except fallback_calls) by the time spent before running it: [2^(i-1), 2^i) ns
+};
+
+struct runtime_stats {
+	cache_stats cache;
+	std::vector<specialization_stats> specializations; // those currently in the cache
+};
+
+// Per-call statistics are only collected while enabled (by default, they are if DOARR_STATS is set).
+// DOARR_STATS=<path> also writes the statistics to the path as JSON at exit.
+void set_stats_enabled(bool enabled) noexcept;
+runtime_stats stats();
+void write_stats_json(std::FILE *out);
+
 }
 
 #endif
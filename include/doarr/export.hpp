@@ -10,10 +10,88 @@
 // and noarr proto-structures, so we include them here.
 #include "any_.hpp"
 
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
 namespace doarr {
 
 using exported = void;
 
+namespace internal {
+
+// Generic fallbacks, instantiated by dcc for each exported function that is not a template.
+// The value is null if some parameter cannot be passed as a dynamic value.
+// Otherwise, it converts the values (if their tags fit) and calls the function. It returns 0 if they do not fit.
+
+template<typename P>
+constexpr bool generic_param = std::is_arithmetic_v<P> || std::is_enum_v<P> || std::is_pointer_v<P>;
+
+template<typename P>
+constexpr bool generic_accepts(char tag) noexcept {
+	if constexpr(std::is_pointer_v<P>)
+		return tag == 'p';
+	else
+		return tag == 'i' || tag == 'f';
+}
+
+template<typename P>
+constexpr P generic_convert(const tagged_any &a) noexcept {
+	if constexpr(std::is_pointer_v<P>)
+		return (P) a.value.p;
+	else
+		return a.tag == 'i' ? (P) a.value.i : (P) a.value.f;
+}
+
+template<auto F>
+struct generic_entry {
+	static constexpr int (*value)(const void *, unsigned long) = nullptr;
+};
+
+template<typename... Params, void (*F)(Params...)>
+struct generic_entry<F> {
+	template<std::size_t... I>
+	static int invoke(const tagged_any *args, std::index_sequence<I...>) {
+		(void) args;
+		if(!(... && generic_accepts<std::remove_cv_t<Params>>(args[I].tag)))
+			return 0;
+		F(generic_convert<std::remove_cv_t<Params>>(args[I])...);
+		return 1;
+	}
+
+	static int run(const void *args, unsigned long num_args) {
+		if(num_args != sizeof...(Params))
+			return 0;
+		return invoke((const tagged_any *) args, std::index_sequence_for<Params...>());
+	}
+
+	static constexpr int (*value)(const void *, unsigned long) = (... && generic_param<std::remove_cv_t<Params>>) ? run : nullptr;
+};
+
+using parallel_chunk_fn = void (void *body, std::size_t begin, std::size_t end) noexcept;
+using parallel_run_fn = void (std::size_t begin, std::size_t end, parallel_chunk_fn *chunk, void *body);
+
+}
+
+}
+
+// The thread pool of the runtime (defined in pool.cpp). Each compiled module has its own copy of the pointer, set by the runtime when loading it,
+// as the host program does not have to export its symbols.
+extern "C" doarr::internal::parallel_run_fn *doarr_parallel_run;
+
+namespace doarr {
+
+// Runs body(i) for each i in [begin, end) on the thread pool of the runtime (including the calling thread), and returns once all are done.
+// The range is split between the threads in contiguous parts (which idle threads steal chunks from). The body must not throw.
+// Nested loops, and loops started while another thread's loop is running, run serially on the calling thread.
+template<typename F>
+void parallel_for(std::size_t begin, std::size_t end, F &&body) {
+	doarr_parallel_run(begin, end, [](void *body, std::size_t begin, std::size_t end) noexcept {
+		for(std::size_t i = begin; i < end; i++)
+			(*(std::remove_reference_t<F> *) body)(i);
+	}, (void *) &body);
+}
+
 }
 
 #endif
@@ -7,6 +7,8 @@
 
 #include "expr_ctors.hpp"
 
+#include <type_traits>
+
 namespace doarr {
 
 template<typename T>
@@ -138,6 +140,32 @@ inline num dyn(std::size_t value) {
 	return num{dyn_expr(value)};
 }
 
+// placeholder for a dynamic value that is only passed when calling the result of imported::bind, must be a top-level argument
+template<typename T>
+struct slot : std::conditional_t<std::is_pointer_v<T>, ptr, num> {
+	using slot_value_type = T;
+	slot() : std::conditional_t<std::is_pointer_v<T>, ptr, num>(dyn_expr(placeholder())) {}
+
+private:
+	static auto placeholder() noexcept {
+		if constexpr(std::is_pointer_v<T>)
+			return (void *) nullptr;
+		else if constexpr(std::is_floating_point_v<T>)
+			return 0.0;
+		else
+			return std::size_t{0};
+	}
+};
+
+template<typename T>
+slot<T> dyn_slot() {
+	return {};
+}
+
+inline slot<void *> ptr_slot() {
+	return {};
+}
+
 //
 
 template<Expr... Args>
@@ -171,15 +199,15 @@ struct var_tmpl_from {
 //
 
 const struct {
-	const tmpl_from<num>::to<num> lit {qname_expr("noarr::lit")};
-	const tmpl_from<type>::to<fn_from<>::to<noarr_struct>> scalar {qname_expr("noarr::scalar")};
-	const tmpl_from<dim>::to<fn_from<>::to<proto_struct>> vector {qname_expr("noarr::vector")};
-	const tmpl_from<dim>::to<fn_from<num>::to<proto_struct>> sized_vector {qname_expr("noarr::sized_vector")};
-	const var_tmpl_from<dim>::to<var_fn_from<num>::to<proto_struct>> bcast {qname_expr("noarr::bcast")};
-	const var_tmpl_from<dim>::to<fn_from<>::to<proto_struct>> hoist {qname_expr("noarr::hoist")};
-	const var_tmpl_from<dim>::to<var_fn_from<num>::to<proto_struct>> set_length {qname_expr("noarr::set_length")};
-	const tmpl_from<dim, dim, dim>::to<fn_from<num>::to<proto_struct>> into_blocks {qname_expr("noarr::into_blocks")};
-	const fn_from<noarr_struct, ptr>::to<expr> make_bag {qname_expr("noarr::make_bag")};
+	const tmpl_from<num>::to<num> lit {static_qname_expr("noarr::lit")};
+	const tmpl_from<type>::to<fn_from<>::to<noarr_struct>> scalar {static_qname_expr("noarr::scalar")};
+	const tmpl_from<dim>::to<fn_from<>::to<proto_struct>> vector {static_qname_expr("noarr::vector")};
+	const tmpl_from<dim>::to<fn_from<num>::to<proto_struct>> sized_vector {static_qname_expr("noarr::sized_vector")};
+	const var_tmpl_from<dim>::to<var_fn_from<num>::to<proto_struct>> bcast {static_qname_expr("noarr::bcast")};
+	const var_tmpl_from<dim>::to<fn_from<>::to<proto_struct>> hoist {static_qname_expr("noarr::hoist")};
+	const var_tmpl_from<dim>::to<var_fn_from<num>::to<proto_struct>> set_length {static_qname_expr("noarr::set_length")};
+	const tmpl_from<dim, dim, dim>::to<fn_from<num>::to<proto_struct>> into_blocks {static_qname_expr("noarr::into_blocks")};
+	const fn_from<noarr_struct, ptr>::to<expr> make_bag {static_qname_expr("noarr::make_bag")};
 } noarr;
 
 }
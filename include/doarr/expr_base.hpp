@@ -5,15 +5,23 @@
  * Public interface of bare expr. See expr.hpp for user-friendly wrappers.
  */
 
-#include <memory>
+#include <cstddef>
+#include <functional>
+#include <utility>
 
 namespace doarr {
 
 class expr;
 
+namespace runtime {
+	struct exs;
+}
+
 namespace internal {
 	class expr_impl;
 	class expr_impl_base {
+		static constexpr std::size_t immortal = -1; // refcount of nodes that are never freed (and may be shared between threads)
+
 		std::size_t refcount;
 		std::size_t hash;
 
@@ -31,15 +39,17 @@ namespace internal {
 class expr {
 	internal::expr_impl_base *impl;
 
+	constexpr explicit expr() noexcept : impl(nullptr) {} // for the arrays built by runtime::exs
+
 	static void del(internal::expr_impl_base *impl) noexcept;
 
 	constexpr void incref() const noexcept {
-		if(impl)
+		if(impl && impl->refcount != impl->immortal)
 			impl->refcount++;
 	}
 
 	constexpr void decref() const noexcept {
-		if(impl) {
+		if(impl && impl->refcount != impl->immortal) {
 			if(impl->refcount == 1)
 				del(impl);
 			else
@@ -88,6 +98,7 @@ public:
 	friend constexpr void swap(expr &a, expr &b) noexcept {
 		std::swap(a.impl, b.impl);
 	}
+	friend runtime::exs;
 	friend bool operator ==(const expr &, const expr &) noexcept;
 	friend constexpr std::size_t hash(const expr &e) noexcept {
 		return e.impl->hash;
@@ -100,27 +111,48 @@ concept ExprNoexcept = requires(T t, void f(Expected) noexcept) {
 };
 
 class exprs {
-	const std::size_t num_items;
-	std::unique_ptr<expr[]> items;
+	static constexpr std::size_t inline_capacity = 4;
+
+	std::size_t num_items;
+	expr *items; // either inline_items or allocated (when there are more)
+	expr inline_items[inline_capacity] = {expr(nullptr), expr(nullptr), expr(nullptr), expr(nullptr)};
 
 public:
-	constexpr explicit exprs() : num_items(0) {}
-	explicit exprs(ExprNoexcept auto&&... items) : num_items(sizeof...(items)), items(new (expr[sizeof...(items)]){decltype(items)(items)...}) {}
+	constexpr explicit exprs() noexcept : num_items(0), items(inline_items) {}
+	explicit exprs(ExprNoexcept auto&&... items) : num_items(sizeof...(items)), items(inline_items) {
+		if constexpr(sizeof...(items) <= inline_capacity) {
+			std::size_t i = 0;
+			(..., (inline_items[i++] = expr(decltype(items)(items))));
+		} else {
+			this->items = new (expr[sizeof...(items)]){decltype(items)(items)...};
+		}
+	}
 	explicit exprs(const exprs &) = delete;
-	explicit exprs(exprs &&) noexcept = default;
+	explicit exprs(exprs &&src) noexcept : num_items(src.num_items), items(src.items == src.inline_items ? inline_items : src.items) {
+		if(items == inline_items)
+			for(std::size_t i = 0; i < num_items; i++)
+				inline_items[i] = std::move(src.inline_items[i]);
+		src.num_items = 0;
+		src.items = src.inline_items;
+	}
 	void operator =(const exprs &) = delete;
 	void operator =(exprs &&) = delete;
+	~exprs() {
+		if(items != inline_items)
+			delete[] items;
+	}
 
 	constexpr std::size_t size() const noexcept {
 		return num_items;
 	}
 	const expr *begin() const noexcept {
-		return items.get();
+		return items;
 	}
 	const expr *end() const noexcept {
-		return items.get() + num_items;
+		return items + num_items;
 	}
 
+	friend runtime::exs;
 	friend bool operator ==(const exprs &, const exprs &) noexcept;
 	friend std::size_t hash(const exprs &) noexcept;
 };
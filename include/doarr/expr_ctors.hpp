@@ -30,6 +30,8 @@ expr infix_expr(const infix_op &op, expr &&left, expr &&right);
 expr char_expr(char value);
 expr int_expr(std::size_t value);
 expr qname_expr(const char *qname);
+// like qname_expr, but the node is never freed, so it is copied without refcounting and can be shared between threads
+expr static_qname_expr(const char *qname);
 
 }
 
@@ -7,6 +7,7 @@
 
 #include "call_.hpp"
 
+#include <string_view>
 #include <utility>
 
 namespace doarr {
@@ -32,6 +33,19 @@ class imported : internal::guest_fn {
 			call(fn, true, std::move(tmpl_args), exprs{decltype(args)(args).to_expr()...});
 		}
 
+		specialization_future compile_async(auto&&... args) && {
+			return internal::compile_async(fn, true, std::move(tmpl_args), exprs{decltype(args)(args).to_expr()...});
+		}
+
+		doarr::request request(auto&&... args) && {
+			return doarr::request(fn, true, std::move(tmpl_args), exprs{decltype(args)(args).to_expr()...});
+		}
+
+		template<typename... Args>
+		internal::bound_for_t<Args...> bind(Args&&... args) && {
+			return internal::bind(fn, true, std::move(tmpl_args), decltype(args)(args)...);
+		}
+
 		friend imported;
 	};
 
@@ -45,6 +59,37 @@ public:
 		call(this, false, exprs{}, exprs{decltype(args)(args).to_expr()...});
 	}
 
+	// like operator(), but returns immediately and compiles in the background
+	specialization_future compile_async(auto&&... args) const {
+		return internal::compile_async(this, false, exprs{}, exprs{decltype(args)(args).to_expr()...});
+	}
+
+	// describes a call to be compiled ahead of time by prepare_all (the dynamic values are ignored), or run by fuse
+	doarr::request request(auto&&... args) const {
+		return doarr::request(this, false, exprs{}, exprs{decltype(args)(args).to_expr()...});
+	}
+
+	// whether dcc precompiled a generic version (with -fdoarr-generic), which runs calls with dynamic and literal arguments until their specializations are compiled
+	bool has_fallback() const noexcept {
+		return generic && *generic;
+	}
+
+	// compiles the call and returns a callable that only takes the values for the slots (see dyn_slot and ptr_slot in expr.hpp)
+	template<typename... Args>
+	internal::bound_for_t<Args...> bind(Args&&... args) const {
+		return internal::bind(this, false, exprs{}, decltype(args)(args)...);
+	}
+
+	// compiles the call without running it
+	void prepare(auto&&... args) const {
+		prepare_all(request(decltype(args)(args)...));
+	}
+
+	// replaces the extra compiler flags for this function (see doarr::set_compiler_options), "" removes them
+	void set_compiler_options(std::string_view flags) const {
+		internal::set_compiler_options(this, flags);
+	}
+
 #ifdef __cpp_multidimensional_subscript
 	instance operator[](auto&&... args) const {
 		return instance{this, exprs{decltype(args)(args).to_expr()...}};
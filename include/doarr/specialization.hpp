@@ -0,0 +1,140 @@
+#ifndef DOARR_SPECIALIZATION_HPP_
+#define DOARR_SPECIALIZATION_HPP_
+
+/*
+ * Handles to runtime-compiled specializations, returned by import.hpp types. Defined in call.cpp.
+ */
+
+#include "any_.hpp"
+#include "expr_base.hpp"
+
+#include <coroutine>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace doarr {
+
+namespace internal {
+	struct cache_entry;
+	struct guest_fn;
+}
+
+// a compiled specialization, bound to the dynamic values it was requested with (it is never unloaded while this exists)
+class specialization {
+	internal::cache_entry *entry;
+	std::unique_ptr<internal::any[]> params;
+
+	explicit specialization(internal::cache_entry *entry, std::unique_ptr<internal::any[]> &&params) noexcept : entry(entry), params(std::move(params)) {}
+
+	friend class specialization_future;
+
+public:
+	specialization(specialization &&src) noexcept : entry(src.entry), params(std::move(src.params)) {
+		src.entry = nullptr;
+	}
+	specialization &operator =(specialization &&src) noexcept {
+		std::swap(entry, src.entry);
+		std::swap(params, src.params);
+		return *this;
+	}
+	~specialization();
+
+	void operator()() const;
+};
+
+namespace internal {
+
+// the type-erased part of doarr::bound
+class bound_base {
+protected:
+	cache_entry *entry = nullptr;
+	void (*fn)(const any *);
+	bool direct; // the slots are all the params, in order
+	std::size_t num_params, num_slots;
+	std::unique_ptr<any[]> params; // fixed dynamic values, the slots are filled in by invoke_indirect
+	std::unique_ptr<std::size_t[]> slot_params; // the index in params for each slot
+
+	void invoke_indirect(const any *slot_values) const;
+
+	explicit bound_base() noexcept = default;
+
+	friend bound_base bind(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args, const bool *is_slot);
+
+public:
+	bound_base(bound_base &&src) noexcept :
+		entry(src.entry), fn(src.fn), direct(src.direct), num_params(src.num_params), num_slots(src.num_slots),
+		params(std::move(src.params)), slot_params(std::move(src.slot_params)) {
+		src.entry = nullptr;
+	}
+	void operator =(bound_base &&) = delete;
+	~bound_base();
+};
+
+template<typename T>
+any to_any(T value) noexcept {
+	if constexpr(std::is_pointer_v<T>)
+		return any{.p = (void *) value};
+	else if constexpr(std::is_floating_point_v<T>)
+		return any{.f = (double) value};
+	else
+		return any{.i = (std::size_t) value};
+}
+
+}
+
+// A specialization resolved once by imported::bind (it is never unloaded while this exists).
+// Calling it only takes the values for the slots (see dyn_slot and ptr_slot in expr.hpp), in order.
+template<typename... Ts>
+class bound : internal::bound_base {
+public:
+	explicit bound(internal::bound_base &&base) noexcept : bound_base(std::move(base)) {}
+
+	void operator()(Ts... values) const {
+		const internal::any slot_values[sizeof...(Ts) + 1] = {internal::to_any(values)...};
+		if(direct)
+			fn(slot_values);
+		else
+			invoke_indirect(slot_values);
+	}
+};
+
+// a specialization that may still be compiling in the background
+class specialization_future {
+	internal::cache_entry *entry;
+	std::unique_ptr<internal::any[]> params;
+	int fd = -1;
+	void *awaiting = nullptr; // the coroutine suspended by await_suspend
+
+public:
+	explicit specialization_future(internal::cache_entry *entry, std::unique_ptr<internal::any[]> &&params) noexcept : entry(entry), params(std::move(params)) {}
+	specialization_future(specialization_future &&src) noexcept : entry(src.entry), params(std::move(src.params)), fd(src.fd), awaiting(src.awaiting) {
+		src.entry = nullptr;
+		src.fd = -1;
+		src.awaiting = nullptr;
+	}
+	void operator =(specialization_future &&) = delete;
+	~specialization_future();
+
+	bool ready() const noexcept;
+	void wait() const noexcept;
+	// waits, then returns the specialization or throws the compilation error
+	specialization get() &&;
+
+	// returns an eventfd-like descriptor that becomes readable once ready, owned by this object
+	int notify_fd();
+
+	// co_await support; the coroutine is resumed by the background thread that finished the compilation
+	bool await_ready() const noexcept {
+		return ready();
+	}
+	bool await_suspend(std::coroutine_handle<> continuation);
+	specialization await_resume() {
+		return std::move(*this).get();
+	}
+};
+
+}
+
+#endif
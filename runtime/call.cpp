@@ -1,36 +1,197 @@
 #include <doarr/call_.hpp>
+#include <doarr/export.hpp>
+#include <doarr/expr_ctors.hpp>
 #include "expr_util.hpp"
 extern "C" {
 #include "io.h"
+#include "trace.h"
 }
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+using doarr::expr;
 using doarr::exprs;
+using doarr::internal::any;
+using doarr::internal::compiler_options;
 using doarr::internal::guest_fn;
+using doarr::internal::tagged_any;
 using namespace doarr::runtime;
 
+// Extra compiler flags, split into arguments. They are interned (and never freed), so they compare by address.
+struct doarr::internal::compiler_options {
+	std::string flags; // the arguments separated by single spaces
+	std::vector<std::string> args;
+	std::vector<const char *> argv; // points into args
+};
+
 namespace {
 
+struct options_state {
+	std::mutex mutex; // guards the rest
+	std::unordered_map<std::string, std::unique_ptr<compiler_options>> interned;
+	const compiler_options *global = nullptr;
+	std::unordered_map<const guest_fn *, const compiler_options *> per_fn;
+	std::atomic<std::uint64_t> version = 1; // bumped by every change of the global or per-function options
+
+	options_state() {
+		if(const char *flags = std::getenv("DOARR_CXXFLAGS"))
+			global = intern(flags);
+	}
+
+	// must be called with the mutex locked, returns nullptr if there are no flags
+	const compiler_options *intern(std::string_view flags) {
+		std::vector<std::string> args;
+		std::string normalized;
+		for(std::size_t i = 0; i < flags.size();) {
+			std::size_t end = flags.find_first_of(" \t\n", i);
+			if(end == flags.npos)
+				end = flags.size();
+			if(end > i) {
+				args.emplace_back(flags.substr(i, end - i));
+				normalized += (normalized.empty() ? "" : " ") + args.back();
+			}
+			i = end + 1;
+		}
+		if(args.empty())
+			return nullptr;
+		auto &o = interned[normalized];
+		if(!o) {
+			o = std::make_unique<compiler_options>(normalized, std::move(args));
+			for(const auto &arg : o->args)
+				o->argv.push_back(arg.c_str());
+		}
+		return o.get();
+	}
+
+	// must be called with the mutex locked
+	const compiler_options *combine(const compiler_options *a, const compiler_options *b) {
+		if(!a)
+			return b;
+		if(!b)
+			return a;
+		return intern(a->flags + " " + b->flags);
+	}
+};
+
+options_state &GLOBAL_options_state() {
+	static options_state instance;
+	return instance;
+}
+
+thread_local const compiler_options *GLOBAL_scope_options; // see compiler_options_scope
+
+// the last result of current_options for a few functions, so that a call does not have to lock anything
+struct options_memo {
+	const guest_fn *fn;
+	std::uint64_t version;
+	const compiler_options *scope, *result;
+};
+
+thread_local options_memo GLOBAL_options_memo[8];
+
+// the options in effect for a call of fn from this thread
+const compiler_options *current_options(const guest_fn *fn) {
+	auto &state = GLOBAL_options_state();
+	std::uint64_t version = state.version.load(std::memory_order_acquire);
+	const compiler_options *scope = GLOBAL_scope_options;
+	options_memo &memo = GLOBAL_options_memo[(std::uintptr_t) fn / alignof(guest_fn) % std::size(GLOBAL_options_memo)];
+	if(memo.fn == fn && memo.version == version && memo.scope == scope)
+		return memo.result;
+
+	std::lock_guard lock(state.mutex);
+	const compiler_options *result = state.global;
+	if(auto it = state.per_fn.find(fn); it != state.per_fn.end())
+		result = state.combine(result, it->second);
+	result = state.combine(result, scope);
+	memo = {fn, state.version.load(std::memory_order_relaxed), scope, result};
+	return result;
+}
+
+// the arguments of a call, looked up in the cache without moving them into a cache_key
+struct key_ref {
+	std::size_t hash;
+	const guest_fn *fn;
+	const compiler_options *options;
+	bool have_tmpl_args;
+	bool fused = false;
+	std::span<void *const> fused_files;
+	exprs &tmpl_args;
+	exprs &call_args;
+
+	explicit key_ref(const guest_fn *fn, bool have_tmpl_args, exprs &tmpl_args, exprs &call_args) :
+		key_ref(fn, current_options(fn), have_tmpl_args, tmpl_args, call_args) {}
+
+	explicit key_ref(const guest_fn *fn, const compiler_options *options, bool have_tmpl_args, exprs &tmpl_args, exprs &call_args) :
+		fn(fn),
+		options(options),
+		have_tmpl_args(have_tmpl_args),
+		tmpl_args(tmpl_args),
+		call_args(call_args) {
+		hash = hash_all((std::size_t) fn, (std::size_t) options, have_tmpl_args, tmpl_args, call_args);
+	}
+
+	// the calls of doarr::fuse (see cache_key::fused), with the options of the first function
+	explicit key_ref(const guest_fn *first, std::span<void *const> fused_files, exprs &no_tmpl_args, exprs &calls) :
+		key_ref(first, false, no_tmpl_args, calls) {
+		fused = true;
+		this->fused_files = fused_files;
+		hash = hash_all(hash, fused);
+		for(void *file : fused_files)
+			hash = hash_all(hash, (std::size_t) file);
+	}
+};
+
 struct cache_key {
 	std::size_t hash;
 	const guest_fn *fn;
+	const compiler_options *options; // nullptr if none
 	bool have_tmpl_args;
+	bool fused; // call_args are whole calls (see doarr::fuse), fn is the first one (and its file the one with the precompiled header)
+	std::vector<void *> fused_files; // the other guest files of the calls, their sources are included
 	exprs tmpl_args;
 	exprs call_args;
 
-	explicit cache_key(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args) :
-		hash(hash_all((std::size_t) fn, have_tmpl_args, tmpl_args, call_args)),
-		fn(fn),
-		have_tmpl_args(have_tmpl_args),
-		tmpl_args(std::move(tmpl_args)),
-		call_args(std::move(call_args)) {}
+	// moves the arguments out of k
+	explicit cache_key(const key_ref &k) :
+		hash(k.hash),
+		fn(k.fn),
+		options(k.options),
+		have_tmpl_args(k.have_tmpl_args),
+		fused(k.fused),
+		fused_files(k.fused_files.begin(), k.fused_files.end()),
+		tmpl_args(std::move(k.tmpl_args)),
+		call_args(std::move(k.call_args)) {}
 
-	friend bool operator ==(const cache_key &a, const cache_key &b) {
+	template<typename K>
+	friend bool operator ==(const cache_key &a, const K &b) {
 		return a.hash == b.hash
 			&& a.fn == b.fn
+			&& a.options == b.options
 			&& a.have_tmpl_args == b.have_tmpl_args
+			&& a.fused == b.fused
+			&& std::ranges::equal(a.fused_files, b.fused_files)
 			&& a.tmpl_args == b.tmpl_args
 			&& a.call_args == b.call_args
 			;
@@ -42,9 +203,365 @@ struct cache_value {
 	void *fn;
 };
 
-using cache_key_hash = decltype([](const cache_key &k) constexpr noexcept { return k.hash; });
+struct completion_hook {
+	void (*fn)(void *arg);
+	void *arg;
+
+	friend bool operator ==(const completion_hook &, const completion_hook &) = default;
+};
+
+using clk = std::chrono::steady_clock;
+
+std::uint64_t to_ns(clk::duration d) noexcept {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+std::atomic<bool> GLOBAL_stats_enabled = false;
+
+// per-call statistics of an entry, only collected while GLOBAL_stats_enabled
+struct call_stats {
+	static constexpr std::size_t num_buckets = doarr::specialization_stats::num_buckets;
+
+	std::atomic<std::uint64_t> hits = 0, misses = 0, fallback_calls = 0;
+	std::atomic<std::uint64_t> overhead_hist[num_buckets] = {};
+
+	void record_call(bool hit, clk::duration overhead) noexcept {
+		(hit ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+		std::size_t bucket = std::min<std::size_t>(std::bit_width(to_ns(overhead)), num_buckets - 1);
+		overhead_hist[bucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void record_fallback() noexcept {
+		misses.fetch_add(1, std::memory_order_relaxed);
+		fallback_calls.fetch_add(1, std::memory_order_relaxed);
+	}
+};
+
+// see doarr::set_value_profiling
+std::atomic<std::size_t> GLOBAL_profile_calls = [] {
+	const char *value = std::getenv("DOARR_PROFILE_CALLS");
+	return value ? std::strtoull(value, nullptr, 10) : 0;
+}();
+
+// The values of the dynamic params over windows of GLOBAL_profile_calls calls of an entry (only through imported::operator() once ready),
+// to compile a variant with those that did not change during a window as literals (see profile_call and try_variant).
+struct value_profile {
+	static constexpr std::size_t max_params = 8; // only the first few are profiled
+
+	std::atomic<std::size_t> calls = 0; // profiled in the current window
+	std::atomic<std::size_t> first[max_params] = {}; // the values in the first call of the window
+	std::atomic<std::uint32_t> changed = 0; // bits of the params that differed from first since
+	std::atomic<bool> done = false; // the variant is compiled, or no param can be a literal
+	std::atomic<std::uint32_t> candidates = ~0u; // bits of the params that can be literals (integers), narrowed when the first window ends
+	std::atomic<doarr::internal::cache_entry *> variant = nullptr; // pinned by the entry, published after the rest
+	std::uint32_t fixed = 0; // bits of the params that are literals in variant
+	std::size_t values[max_params]; // their values
+};
+
+}
+
+struct doarr::internal::cache_entry {
+	enum state_t { compiling, ready, failed, evicted };
+
+	const cache_key key;
+	std::atomic<state_t> state = compiling;
+	cache_value value; // valid in states ready and evicted (as long as the current thread is in an epoch_guard)
+	std::exception_ptr error; // valid in state failed
+	std::vector<completion_hook> hooks; // guarded by GLOBAL_hooks_mutex, run once the state is no longer compiling
+	std::thread::id hooks_runner; // guarded by GLOBAL_hooks_mutex, the thread running the hooks (see remove_hook)
+	std::atomic<std::size_t> pins = 0; // handles that keep the entry from being evicted
+	std::atomic<std::uint64_t> last_use = 0; // see GLOBAL_lru_clock
+	const std::size_t num_params;
+	std::vector<std::uint32_t> param_plan; // see exs::plan_params
+	std::uint64_t compile_ns = 0; // set before the state is no longer compiling
+	bool from_disk = false; // likewise
+	call_stats stats;
+	value_profile profile;
+
+	explicit cache_entry(cache_key &&key) :
+		key(std::move(key)),
+		num_params(exs::num_params(this->key.call_args)) {
+		exs::plan_params(this->key.call_args, param_plan);
+	}
+	cache_entry(const cache_entry &) = delete;
+	void operator =(const cache_entry &) = delete;
+	~cache_entry() {
+		if(cache_entry *v = profile.variant.load(std::memory_order_relaxed))
+			v->pins.fetch_sub(1, std::memory_order_release); // see unpin
+	}
+
+	// extracts the params from call_args (equal to key.call_args)
+	void extract_params(const exprs &call_args, any *out) const noexcept {
+		exs::extract_planned_params(call_args, param_plan.data(), num_params, out);
+	}
+
+	// returns false if the compilation failed
+	bool wait() const noexcept {
+		state_t s;
+		while((s = state.load(std::memory_order_acquire)) == compiling)
+			state.wait(compiling, std::memory_order_acquire);
+		return s != failed;
+	}
+};
+
+using doarr::internal::cache_entry;
+
+namespace {
+
+// Epoch-based reclamation: whatever gets removed from the cache (evicted entries with their modules, replaced tables)
+// is only freed once all the threads that were using the cache at the time of the removal have left it.
+// Entries may be used without an epoch_guard only while pinned or compiling (these are never evicted).
+struct thread_record {
+	std::atomic<std::uint64_t> epoch = 0; // 0 = not in an epoch_guard
+	std::atomic<bool> taken = true;
+	unsigned depth = 0; // only accessed by the owning thread
+	thread_record *next = nullptr;
+};
+
+std::atomic<std::uint64_t> GLOBAL_epoch = 1;
+std::atomic<thread_record *> GLOBAL_thread_records = nullptr; // never freed, reused by later threads
+
+thread_record *acquire_thread_record() {
+	for(auto *r = GLOBAL_thread_records.load(std::memory_order_acquire); r; r = r->next)
+		if(!r->taken.load(std::memory_order_relaxed) && !r->taken.exchange(true, std::memory_order_acquire))
+			return r;
+	auto *r = new thread_record;
+	r->next = GLOBAL_thread_records.load(std::memory_order_relaxed);
+	while(!GLOBAL_thread_records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed));
+	return r;
+}
+
+thread_record &this_thread_record() {
+	thread_local struct owner {
+		thread_record *const r = acquire_thread_record();
+		~owner() {
+			r->taken.store(false, std::memory_order_release);
+		}
+	} owner;
+	return *owner.r;
+}
+
+class epoch_guard {
+	thread_record &r = this_thread_record();
+
+public:
+	epoch_guard() noexcept {
+		if(!r.depth++) {
+			r.epoch.exchange(GLOBAL_epoch.load(std::memory_order_acquire), std::memory_order_seq_cst); // a full barrier, pairs with the fence in reclaim
+		}
+	}
+	epoch_guard(const epoch_guard &) = delete;
+	void operator =(const epoch_guard &) = delete;
+	~epoch_guard() {
+		if(!--r.depth)
+			r.epoch.store(0, std::memory_order_release);
+	}
+};
+
+// a loaded shared library, unloaded once all its entries have been evicted
+struct module {
+	void *const handle;
+	const std::size_t size;
+	std::vector<cache_entry *> entries;
+
+	explicit module(void *handle) : handle(handle), size(doarr_module_size(handle)) {
+		// the module's own copy of the pointer (see export.hpp), before any entry point can run
+		if(void *p = doarr_lookup_symbol(handle, "doarr_parallel_run"))
+			*(doarr::internal::parallel_run_fn **) p = doarr_parallel_run;
+	}
+	module(const module &) = delete;
+	void operator =(const module &) = delete;
+	~module() {
+		for(cache_entry *e : entries)
+			delete e;
+		doarr_module_unload(handle);
+	}
+};
+
+// Open addressing hash table with linear probing. Lookups do not lock anything (but need an epoch_guard):
+// slots only change while holding GLOBAL_cache_mutex, from null to an entry, from a failed entry to its replacement,
+// or from an evicted entry to a tombstone. When the table gets too full, it is copied (without the tombstones) and retired.
+struct cache_table {
+	const std::size_t mask;
+	std::size_t used = 0, tombstones = 0; // only accessed while holding GLOBAL_cache_mutex
+	const std::unique_ptr<std::atomic<cache_entry *>[]> slots;
+
+	explicit cache_table(std::size_t size) : mask(size - 1), slots(new std::atomic<cache_entry *>[size]()) {}
+
+	static cache_entry *tombstone() noexcept {
+		static char address;
+		return (cache_entry *) &address;
+	}
+
+	std::atomic<cache_entry *> *find(const auto &k) const noexcept {
+		for(std::size_t i = k.hash;; i++) {
+			auto *slot = &slots[i & mask];
+			cache_entry *e = slot->load(std::memory_order_acquire);
+			if(!e || e != tombstone() && e->key == k)
+				return slot;
+		}
+	}
+};
+
+std::mutex GLOBAL_cache_mutex;
+std::atomic<cache_table *> GLOBAL_cache = nullptr;
+std::atomic<std::uint64_t> GLOBAL_lru_clock = 0; // advanced with each loaded module, entries remember when they were last used
+
+// everything guarded by GLOBAL_cache_mutex (except the table itself)
+struct cache_state {
+	struct retired {
+		std::uint64_t epoch;
+		std::unique_ptr<cache_table> table;
+		std::unique_ptr<module> mod;
+	};
+
+	std::vector<module *> modules;
+	std::vector<retired> limbo;
+	std::size_t max_modules, max_bytes; // 0 = unlimited
+	std::size_t bytes = 0, evictions = 0, reloads = 0;
+	std::size_t evicted_hashes[1024] = {}; // recently evicted keys, to count reloads
+
+	static std::size_t env_size(const char *name) {
+		const char *value = std::getenv(name);
+		return value ? std::strtoull(value, nullptr, 10) : 0;
+	}
+
+	cache_state() : max_modules(env_size("DOARR_CACHE_MAX_MODULES")), max_bytes(env_size("DOARR_CACHE_MAX_BYTES")) {}
+};
+
+cache_state &GLOBAL_cache_state() {
+	static cache_state *instance = new cache_state; // leaked, background compilations may outlive static destructors
+	return *instance;
+}
+
+// must be called with GLOBAL_cache_mutex locked
+void retire(std::unique_ptr<cache_table> &&table, std::unique_ptr<module> &&mod) {
+	std::uint64_t epoch = GLOBAL_epoch.fetch_add(1, std::memory_order_acq_rel);
+	GLOBAL_cache_state().limbo.push_back({epoch, std::move(table), std::move(mod)});
+}
+
+// must be called with GLOBAL_cache_mutex locked
+void reclaim() {
+	auto &limbo = GLOBAL_cache_state().limbo;
+	if(limbo.empty())
+		return;
+	std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the exchange in epoch_guard
+	std::uint64_t oldest = UINT64_MAX;
+	for(auto *r = GLOBAL_thread_records.load(std::memory_order_acquire); r; r = r->next)
+		if(std::uint64_t epoch = r->epoch.load(std::memory_order_acquire))
+			oldest = std::min(oldest, epoch);
+	std::erase_if(limbo, [oldest](const cache_state::retired &r) { return r.epoch < oldest; });
+}
+
+// must be called with GLOBAL_cache_mutex locked
+cache_table *cache_table_for_insert() {
+	cache_table *old = GLOBAL_cache.load(std::memory_order_relaxed);
+	if(old && 2 * (old->used + 1) <= old->mask + 1)
+		return old;
+	std::size_t size = 64;
+	if(old) {
+		size = old->mask + 1;
+		if(4 * (old->used - old->tombstones + 1) > size)
+			size *= 2;
+	}
+	auto *t = new cache_table(size);
+	if(old) {
+		for(std::size_t i = 0; i <= old->mask; i++) {
+			cache_entry *e = old->slots[i].load(std::memory_order_relaxed);
+			if(e && e != cache_table::tombstone()) {
+				t->find(e->key)->store(e, std::memory_order_relaxed);
+				t->used++;
+			}
+		}
+	}
+	GLOBAL_cache.store(t, std::memory_order_release);
+	if(old)
+		retire(std::unique_ptr<cache_table>(old), nullptr);
+	return t;
+}
+
+// keeps the entry from being evicted, fails if it is being evicted (then it must be looked up again)
+bool pin(cache_entry *e) noexcept {
+	e->pins.fetch_add(1, std::memory_order_seq_cst);
+	if(e->state.load(std::memory_order_seq_cst) != cache_entry::evicted)
+		return true;
+	e->pins.fetch_sub(1, std::memory_order_release);
+	return false;
+}
+
+void unpin(cache_entry *e) noexcept {
+	e->pins.fetch_sub(1, std::memory_order_release);
+}
+
+void touch(cache_entry *e) noexcept {
+	std::uint64_t now = GLOBAL_lru_clock.load(std::memory_order_relaxed);
+	if(e->last_use.load(std::memory_order_relaxed) != now)
+		e->last_use.store(now, std::memory_order_relaxed);
+}
+
+// must be called with GLOBAL_cache_mutex locked
+bool try_evict(module *m) {
+	for(cache_entry *e : m->entries)
+		if(e->state.load(std::memory_order_acquire) != cache_entry::ready || e->pins.load(std::memory_order_acquire))
+			return false;
+	for(cache_entry *e : m->entries)
+		e->state.store(cache_entry::evicted, std::memory_order_seq_cst);
+	for(cache_entry *e : m->entries) {
+		if(e->pins.load(std::memory_order_seq_cst)) { // lost the race with pin
+			for(cache_entry *e : m->entries)
+				e->state.store(cache_entry::ready, std::memory_order_release);
+			return false;
+		}
+	}
 
-std::unordered_map<cache_key, cache_value, cache_key_hash> GLOBAL_cache;
+	auto &state = GLOBAL_cache_state();
+	cache_table *t = GLOBAL_cache.load(std::memory_order_relaxed);
+	for(cache_entry *e : m->entries) {
+		t->find(e->key)->store(cache_table::tombstone(), std::memory_order_release);
+		t->tombstones++;
+		state.evicted_hashes[e->key.hash % std::size(state.evicted_hashes)] = e->key.hash;
+	}
+	std::erase(state.modules, m);
+	state.bytes -= m->size;
+	state.evictions += m->entries.size();
+	retire(nullptr, std::unique_ptr<module>(m));
+	return true;
+}
+
+// must be called with GLOBAL_cache_mutex locked
+void enforce_budget() {
+	auto &state = GLOBAL_cache_state();
+	auto over_budget = [&state] {
+		return state.max_modules && state.modules.size() > state.max_modules
+			|| state.max_bytes && state.bytes > state.max_bytes;
+	};
+	if(over_budget()) {
+		// least recently used first
+		std::vector<std::pair<std::uint64_t, module *>> candidates;
+		for(module *m : state.modules) {
+			std::uint64_t last_use = 0;
+			for(cache_entry *e : m->entries)
+				last_use = std::max(last_use, e->last_use.load(std::memory_order_relaxed));
+			candidates.emplace_back(last_use, m);
+		}
+		std::ranges::sort(candidates);
+		for(auto [last_use, m] : candidates)
+			if(try_evict(m) && !over_budget())
+				break;
+	}
+	reclaim();
+}
+
+// must be called with GLOBAL_cache_mutex locked
+void register_module(std::unique_ptr<module> &&m) {
+	auto &state = GLOBAL_cache_state();
+	std::uint64_t now = GLOBAL_lru_clock.fetch_add(1, std::memory_order_relaxed) + 1;
+	for(cache_entry *e : m->entries)
+		e->last_use.store(now, std::memory_order_relaxed);
+	state.bytes += m->size;
+	state.modules.push_back(m.release());
+	enforce_budget();
+}
 
 struct doarr_io_ctx *GLOBAL_io_ctx() {
 	static struct lazy_init : doarr_io_ctx {
@@ -56,6 +573,19 @@ struct doarr_io_ctx *GLOBAL_io_ctx() {
 	return &instance;
 }
 
+// DOARR_EARLY_INIT=1 initializes at load time, while the process is still small (see doarr::init)
+const bool GLOBAL_io_ctx_early = [] {
+	const char *value = std::getenv("DOARR_EARLY_INIT");
+	if(!value || !*value || !std::strcmp(value, "0"))
+		return false;
+	try {
+		GLOBAL_io_ctx();
+	} catch(const std::runtime_error &) {
+		// retried (and reported) on first use
+	}
+	return true;
+}();
+
 template<int N>
 void w1(std::FILE *out, const char (&s)[N]) {
 	std::fwrite(s, 1, N-1, out);
@@ -77,29 +607,160 @@ struct guest_file *fn_file(const guest_fn *fn) {
 	return (struct guest_file *) fn->file;
 }
 
-void compile(const guest_fn *fn, bool have_tmpl_args, const cache_key &k, cache_value &out_v) {
+struct free_deleter {
+	void operator()(void *p) const noexcept {
+		std::free(p);
+	}
+};
+
+std::string describe(const cache_key &k) {
+	char *chars;
+	std::size_t size;
+	std::FILE *out = open_memstream(&chars, &size);
+	if(!out)
+		throw std::bad_alloc();
+	if(k.fused) {
+		w(out, "fuse{", k.call_args, "}");
+	} else {
+		w(out, k.fn->name);
+		if(k.have_tmpl_args)
+			w(out, "<", k.tmpl_args, ">");
+		w(out, "(", k.call_args, ")");
+	}
+	if(k.options)
+		w(out, " [", k.options->flags.c_str(), "]");
+	std::fclose(out);
+	std::unique_ptr<char, free_deleter> owner(chars);
+	return std::string(chars, size);
+}
+
+// a phase for the tracer (see trace.h), recorded when it goes out of scope
+class trace_phase {
+	const unsigned long long begin = doarr_trace_begin();
+	const char *const name;
+	std::string detail;
+
+public:
+	explicit trace_phase(const char *name) noexcept : name(name) {}
+	trace_phase(const trace_phase &) = delete;
+	void operator =(const trace_phase &) = delete;
+	~trace_phase() {
+		doarr_trace_end(begin, name, detail.empty() ? nullptr : detail.c_str());
+	}
+
+	bool enabled() const noexcept {
+		return begin;
+	}
+	void set_detail(std::string &&detail) noexcept {
+		this->detail = std::move(detail);
+	}
+};
+
+// The entry point of a single specialization, named DOARR_EXPORT (to be #defined as needed).
+// It does not depend on the process, so it is also used as part of the persistent cache key.
+struct entry_source {
+	std::unique_ptr<char, free_deleter> chars;
+	std::size_t size;
+
+	// k is a cache_key or a key_ref
+	template<typename K>
+	explicit entry_source(const K &k) {
+		char *chars;
+		std::FILE *out = open_memstream(&chars, &size);
+		if(!out)
+			throw std::bad_alloc();
+		for(void *file : k.fused_files)
+			doarr_write_source_include(GLOBAL_io_ctx(), (struct guest_file *) file, out);
+		w(out, "extern \"C\" __attribute__ ((visibility (\"default\"))) void DOARR_EXPORT(const doarr::internal::any *DOARR_EXPORT) {\n");
+		w(out, "(void)DOARR_EXPORT;\n");
+		if(k.fused) {
+			std::size_t param_idx = 0;
+			for(const expr &call : k.call_args) {
+				param_idx = exs::write_to(call, out, param_idx);
+				w(out, ";\n");
+			}
+		} else {
+			w(out, k.fn->name);
+			if(k.have_tmpl_args)
+				w(out, "<", k.tmpl_args, ">");
+			w(out, "(", k.call_args, ");\n");
+		}
+		w(out, "}\n");
+		std::fclose(out);
+		this->chars.reset(chars);
+	}
+};
+
+// Compiles all the entries (which must come from the same guest file and have the same options) into a single shared library,
+// each as a separate entry point DOARR_EXPORT_<n>. Throws if any of them fails.
+void compile_batch(std::span<cache_entry *const> batch) {
 	struct doarr_io_ctx *ctx = GLOBAL_io_ctx();
+	struct guest_file *file = fn_file(batch.front()->key.fn);
+	const compiler_options *options = batch.front()->key.options;
+	const char *const *extra_args = options ? options->argv.data() : nullptr;
+	std::size_t num_extra_args = options ? options->argv.size() : 0;
+	auto begin = clk::now();
+	trace_phase batch_phase("batch");
+	if(batch_phase.enabled()) {
+		std::string detail;
+		for(cache_entry *e : batch)
+			detail += describe(e->key) + "\n";
+		batch_phase.set_detail(std::move(detail));
+	}
 
-	const char *hdr = doarr_extract_precompiled_or_null(ctx, fn_file(fn));
+	std::vector<cache_entry *> pending;
+	std::vector<entry_source> sources;
+	std::vector<struct cache_name> names;
+	for(cache_entry *e : batch) {
+		entry_source src(e->key);
+		if(ctx->cache_dir) {
+			struct cache_name name;
+			doarr_cache_name(ctx, file, extra_args, num_extra_args, src.chars.get(), src.size, &name);
+			if(!doarr_cache_load(ctx, &name, &e->value.handle, &e->value.fn)) {
+				e->compile_ns = to_ns(clk::now() - begin);
+				e->from_disk = true;
+				auto m = std::make_unique<module>(e->value.handle);
+				m->entries.push_back(e);
+				std::lock_guard lock(GLOBAL_cache_mutex);
+				register_module(std::move(m));
+				continue;
+			}
+			names.push_back(name);
+		}
+		pending.push_back(e);
+		sources.push_back(std::move(src));
+	}
+	if(pending.empty())
+		return;
+
+	const char *hdr = doarr_extract_precompiled_or_null(ctx, file);
 	if(!hdr)
 		throw std::runtime_error("Could not extract precompiled header");
 
-	struct tmp_full_path cxx_file_name;
-	doarr_tmp_path(ctx, ".cxx", &cxx_file_name);
-
-	std::FILE *out = std::fopen(cxx_file_name.chars, "w");
-	w(out, "#include \"", hdr, "\"\n");
-	w(out, "#undef DOARR_EXPORT\n");
-	w(out, "extern \"C\" __attribute__ ((visibility (\"default\"))) void DOARR_EXPORT(const doarr::internal::any *DOARR_EXPORT) {\n");
-	w(out, "(void)DOARR_EXPORT;\n");
-	w(out, fn->name);
-	if(have_tmpl_args)
-		w(out, "<", k.tmpl_args, ">");
-	w(out, "(", k.call_args, ");\n");
-	w(out, "}\n");
-	std::fclose(out);
+	struct doarr_source cxx_source;
+	{
+		trace_phase codegen_phase("codegen");
+		std::FILE *out = doarr_source_create(ctx, &cxx_source);
+		if(!out)
+			throw std::runtime_error("Could not write the generated source");
+		w(out, "#include \"", hdr, "\"\n");
+		w(out, "__attribute__ ((visibility (\"default\"))) doarr::internal::parallel_run_fn *doarr_parallel_run = nullptr; // extern \"C\" from export.hpp\n");
+		for(std::size_t i = 0; i < sources.size(); i++) {
+			std::fprintf(out, "#undef DOARR_EXPORT\n#define DOARR_EXPORT DOARR_EXPORT_%zu\n", i);
+			std::fwrite(sources[i].chars.get(), 1, sources[i].size, out);
+		}
+		if(!names.empty()) {
+			// allows loading any single entry point from the persistent cache
+			w(out, "extern \"C\" __attribute__ ((visibility (\"default\"))) const char *const DOARR_EXPORT_names[] = {");
+			for(const auto &name : names)
+				w(out, "\"", name.chars, "\", ");
+			w(out, "nullptr};\n");
+		}
+		std::fclose(out);
+	}
 
-	switch(doarr_compile_and_load(ctx, &cxx_file_name, fn_file(fn), &out_v.handle, &out_v.fn)) {
+	void *handle;
+	switch(doarr_compile_and_load(ctx, &cxx_source, file, extra_args, num_extra_args, names.data(), names.size(), &handle)) {
 		case 0:
 			break; // OK
 		case 1:
@@ -109,26 +770,829 @@ void compile(const guest_fn *fn, bool have_tmpl_args, const cache_key &k, cache_
 		default:
 			abort(); // should not happen
 	}
+
+	auto m = std::make_unique<module>(handle);
+	std::uint64_t compile_ns = to_ns(clk::now() - begin);
+	for(std::size_t i = 0; i < pending.size(); i++) {
+		pending[i]->value.handle = handle;
+		pending[i]->compile_ns = compile_ns;
+		if(doarr_lookup_entry(handle, i, &pending[i]->value.fn))
+			throw std::runtime_error("Could not load the compiled code");
+	}
+	m->entries = std::move(pending);
+	std::lock_guard lock(GLOBAL_cache_mutex);
+	register_module(std::move(m));
 }
 
+std::mutex GLOBAL_hooks_mutex;
+std::condition_variable GLOBAL_hooks_cv; // notified when a thread has finished running the hooks of an entry
+
+void finish_entry(cache_entry *e, std::exception_ptr error) noexcept {
+	std::vector<completion_hook> hooks;
+	{
+		epoch_guard guard; // once ready, the entry may get evicted
+		if(error) {
+			e->error = std::move(error);
+			e->state.store(cache_entry::failed, std::memory_order_release);
+		} else {
+			e->state.store(cache_entry::ready, std::memory_order_release);
+		}
+		e->state.notify_all();
+
+		std::lock_guard lock(GLOBAL_hooks_mutex);
+		if(e->hooks.empty())
+			return;
+		hooks = std::move(e->hooks);
+		e->hooks_runner = std::this_thread::get_id();
+		pin(e); // cannot fail, pinned by the futures that added the hooks (which may be gone before the last hook returns)
+	}
+	for(auto hook : hooks)
+		hook.fn(hook.arg);
+	{
+		std::lock_guard lock(GLOBAL_hooks_mutex);
+		e->hooks_runner = std::thread::id();
+	}
+	GLOBAL_hooks_cv.notify_all();
+	unpin(e);
 }
 
-void doarr::internal::call(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args) {
+void compile_entries(std::span<cache_entry *const> batch) noexcept {
+	std::exception_ptr error;
+	try {
+		compile_batch(batch);
+	} catch(...) {
+		error = std::current_exception();
+	}
+	if(error && batch.size() > 1) {
+		// do not let one bad specialization spoil the others (those loaded from the persistent cache are already registered in their own modules)
+		for(cache_entry *e : batch) {
+			if(e->from_disk)
+				finish_entry(e, nullptr);
+			else
+				compile_entries({&e, 1});
+		}
+		return;
+	}
+	for(cache_entry *e : batch)
+		finish_entry(e, error);
+}
+
+// returns false (without adding the hook) if the entry is no longer compiling
+bool add_hook(cache_entry *e, completion_hook hook) {
+	std::lock_guard lock(GLOBAL_hooks_mutex);
+	if(e->state.load(std::memory_order_acquire) != cache_entry::compiling)
+		return false;
+	e->hooks.push_back(hook);
+	return true;
+}
+
+// once this returns, the hook is not running and will not run (unless the caller is the hook itself, or was called by it)
+void remove_hook(cache_entry *e, completion_hook hook) noexcept {
+	std::unique_lock lock(GLOBAL_hooks_mutex);
+	std::erase(e->hooks, hook);
+	GLOBAL_hooks_cv.wait(lock, [e] {
+		return e->hooks_runner == std::thread::id() || e->hooks_runner == std::this_thread::get_id();
+	});
+}
+
+void resume_coroutine(void *address) {
+	std::coroutine_handle<>::from_address(address).resume();
+}
+
+// Background threads for compile_async. They are started on demand (up to one per CPU) and never stopped.
+// Each of them takes a fair share of the queued entries from the same guest file (and with the same options) and compiles them as one batch.
+class compile_queue {
+	static constexpr std::size_t max_batch = 32;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<cache_entry *> jobs;
+	std::size_t num_idle = 0, num_workers = 0;
+	const std::size_t max_workers = std::max(std::thread::hardware_concurrency(), 1u);
+
+	// must be called with the mutex locked and the queue non-empty
+	std::vector<cache_entry *> take_batch() {
+		const cache_key &front = jobs.front()->key;
+		auto compatible = [file = front.fn->file, options = front.options](cache_entry *e) {
+			return e->key.fn->file == file && e->key.options == options;
+		};
+		std::size_t same_file = std::ranges::count_if(jobs, compatible);
+		std::size_t size = std::min((same_file + max_workers - 1) / max_workers, max_batch);
+
+		std::vector<cache_entry *> batch;
+		for(auto it = jobs.begin(); it != jobs.end() && batch.size() < size;) {
+			if(compatible(*it)) {
+				batch.push_back(*it);
+				it = jobs.erase(it);
+			} else {
+				++it;
+			}
+		}
+		return batch;
+	}
+
+	// the thread is counted as idle from its start
+	void work() {
+		std::unique_lock lock(mutex);
+		for(;;) {
+			cv.wait(lock, [this] { return !jobs.empty(); });
+			num_idle--;
+			auto batch = take_batch();
+			lock.unlock();
+			compile_entries(batch);
+			lock.lock();
+			num_idle++;
+		}
+	}
+
+public:
+	void push(std::span<cache_entry *const> entries) {
+		std::lock_guard lock(mutex);
+		jobs.insert(jobs.end(), entries.begin(), entries.end());
+		while(num_idle < jobs.size() && num_workers < max_workers) {
+			std::thread([this] { work(); }).detach();
+			num_workers++;
+			num_idle++;
+		}
+		cv.notify_all();
+	}
+};
+
+compile_queue &GLOBAL_compile_queue() {
+	static compile_queue *instance = new compile_queue; // leaked, the threads may outlive static destructors
+	return *instance;
+}
+
+// Finds the entry for the key, or inserts a new one (moving the arguments out of k). In the latter case, the caller is responsible for compiling it.
+// A failed entry is replaced by a new attempt, unless keep_failed is set. Must be called in an epoch_guard.
+cache_entry *find_or_insert(const key_ref &k, bool &out_inserted, bool keep_failed = false) {
+	out_inserted = false;
+	auto usable = [keep_failed](cache_entry *e) {
+		auto s = e->state.load(std::memory_order_acquire);
+		return s == cache_entry::compiling || s == cache_entry::ready || s == cache_entry::failed && keep_failed;
+	};
+
+	// fast path: lock-free lookup
+	cache_entry *e = nullptr;
+	if(cache_table *t = GLOBAL_cache.load(std::memory_order_acquire))
+		e = t->find(k)->load(std::memory_order_acquire);
+	if(e && usable(e))
+		return e;
+
+	// slow path: the first thread to miss compiles, the others wait for it
+	std::lock_guard lock(GLOBAL_cache_mutex);
+	cache_table *t = cache_table_for_insert();
+	auto *slot = t->find(k);
+	e = slot->load(std::memory_order_relaxed);
+	if(e && usable(e))
+		return e;
+	if(!e)
+		t->used++;
+	auto &state = GLOBAL_cache_state();
+	if(std::size_t &evicted = state.evicted_hashes[k.hash % std::size(state.evicted_hashes)]; evicted == k.hash) {
+		evicted = 0;
+		state.reloads++;
+	}
+	e = new cache_entry(cache_key(k));
+	slot->store(e, std::memory_order_release);
+	out_inserted = true;
+	return e;
+}
+
+void check_tmpl_args(const exprs &tmpl_args) {
 	if(exs::num_params(tmpl_args))
 		throw std::logic_error("Template argument depends on a dynamic value");
-	auto params_uniq = std::make_unique_for_overwrite<any[]>(exs::num_params(call_args));
-	any *params = params_uniq.get();
-	exs::extract_params(call_args, params);
+}
+
+std::unique_ptr<any[]> params_of(const exprs &tmpl_args, const exprs &call_args) {
+	check_tmpl_args(tmpl_args);
+	auto params = std::make_unique_for_overwrite<any[]>(exs::num_params(call_args));
+	exs::extract_params(call_args, params.get());
+	return params;
+}
+
+// the dynamic values of a call, on the stack unless there are many of them
+class param_buffer {
+	static constexpr std::size_t max_stack_params = 16;
+	any stack_params[max_stack_params];
+	std::unique_ptr<any[]> heap_params;
+
+public:
+	any *const data;
+
+	explicit param_buffer(std::size_t num_params) :
+		heap_params(num_params > max_stack_params ? std::make_unique_for_overwrite<any[]>(num_params) : nullptr),
+		data(heap_params ? heap_params.get() : stack_params) {}
+	param_buffer(const param_buffer &) = delete;
+	void operator =(const param_buffer &) = delete;
+};
+
+constexpr std::size_t max_generic_args = 16;
+
+// evaluates the arguments for the precompiled generic version of the function, returns false if it cannot be used
+bool generic_args(const cache_key &k, const any *params, tagged_any (&out)[max_generic_args]) {
+	return k.call_args.size() <= max_generic_args && exs::eval(k.call_args, params, out);
+}
+
+void invoke(const cache_entry *e, const any *params) {
+	if(!e->wait())
+		std::rethrow_exception(e->error);
+	((void(*)(const any *)) e->value.fn)(params);
+}
+
+// Compiles (in the background) the variant of e with the integer params that kept their first value over the window as literals.
+// Returns false if there are none (yet), to profile another window. Only called by the call that ends the window.
+bool make_variant(cache_entry *e) {
+	value_profile &p = e->profile;
+	std::size_t n = std::min(e->num_params, value_profile::max_params);
+	std::uint32_t changed = p.changed.load(std::memory_order_relaxed);
+	std::uint32_t candidates = p.candidates.load(std::memory_order_relaxed);
+	if(!(candidates & ~changed))
+		return false;
+	param_buffer values(e->num_params);
+	auto fixed = std::make_unique<bool[]>(e->num_params);
+	for(std::size_t i = 0; i < n; i++) {
+		values.data[i].i = p.first[i].load(std::memory_order_relaxed);
+		fixed[i] = !(changed >> i & 1);
+	}
+	const any *values_ptr = values.data;
+	bool *fixed_ptr = fixed.get();
+	exprs call_args;
+	exs::with_literals(e->key.call_args, values_ptr, fixed_ptr, call_args); // clears fixed for pointers and floats
+	std::uint32_t mask = 0;
+	for(std::size_t i = 0; i < n; i++)
+		mask |= (std::uint32_t) fixed[i] << i;
+	candidates &= mask | changed;
+	p.candidates.store(candidates, std::memory_order_relaxed);
+	if(!candidates)
+		p.done.store(true, std::memory_order_relaxed); // nothing to profile
+	if(!mask)
+		return false;
+
+	const any *no_values = nullptr;
+	bool *no_fixed = nullptr;
+	exprs tmpl_args;
+	exs::with_literals(e->key.tmpl_args, no_values, no_fixed, tmpl_args);
+	key_ref k(e->key.fn, e->key.options, e->key.have_tmpl_args, tmpl_args, call_args);
+	bool inserted;
+	cache_entry *v;
+	do v = find_or_insert(k, inserted); while(!pin(v)); // a newly inserted entry cannot fail to pin
+	if(inserted)
+		GLOBAL_compile_queue().push({&v, 1});
+	p.fixed = mask;
+	for(std::size_t i = 0; i < n; i++)
+		p.values[i] = values.data[i].i;
+	p.variant.store(v, std::memory_order_release);
+	return true;
+}
+
+// Records the params of a call of e (which must be ready) in windows of the threshold, until a window ends with some of them unchanged.
+// Then the variant gets compiled and the profiling stops.
+void profile_call(cache_entry *e, const any *params) {
+	value_profile &p = e->profile;
+	std::size_t threshold = GLOBAL_profile_calls.load(std::memory_order_relaxed);
+	if(!threshold || p.done.load(std::memory_order_relaxed))
+		return;
+	std::size_t n = std::min(e->num_params, value_profile::max_params);
+	std::size_t call = p.calls.fetch_add(1, std::memory_order_relaxed);
+	if(call >= threshold)
+		return; // the window is ending in another thread
+	if(call == 0) {
+		for(std::size_t i = 0; i < n; i++)
+			p.first[i].store(params[i].i, std::memory_order_relaxed);
+		return;
+	}
+	// a concurrent first call may not have stored them yet, which only makes the variant less likely (in this window)
+	std::uint32_t changed = 0;
+	for(std::size_t i = 0; i < n; i++)
+		if(params[i].i != p.first[i].load(std::memory_order_relaxed))
+			changed |= 1u << i;
+	if(changed)
+		p.changed.fetch_or(changed, std::memory_order_relaxed);
+	if(call + 1 != threshold)
+		return;
+	if(make_variant(e)) {
+		p.done.store(true, std::memory_order_relaxed);
+	} else {
+		// next window
+		p.changed.store(0, std::memory_order_relaxed);
+		p.calls.store(0, std::memory_order_relaxed);
+	}
+}
+
+// runs the call by the variant of e if it is ready and the params match its literals, returns false otherwise
+bool try_variant(cache_entry *e, const any *params, bool stats, clk::time_point begin) {
+	const value_profile &p = e->profile;
+	cache_entry *v = p.variant.load(std::memory_order_acquire);
+	if(!v || v->state.load(std::memory_order_acquire) != cache_entry::ready)
+		return false;
+	auto is_fixed = [&p](std::size_t i) { return i < value_profile::max_params && p.fixed >> i & 1; };
+	for(std::size_t i = 0; i < value_profile::max_params; i++)
+		if(is_fixed(i) && params[i].i != p.values[i])
+			return false;
+	param_buffer v_params(v->num_params);
+	for(std::size_t i = 0, j = 0; i < e->num_params; i++)
+		if(!is_fixed(i))
+			v_params.data[j++] = params[i];
+	if(stats)
+		v->stats.record_call(true, clk::now() - begin);
+	((void(*)(const any *)) v->value.fn)(v_params.data);
+	return true;
+}
+
+}
+
+void doarr::internal::call(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args) {
+	// a cache hit does not allocate: the params are on the stack and the key refers to the arguments
+	bool stats = GLOBAL_stats_enabled.load(std::memory_order_relaxed);
+	auto begin = stats ? clk::now() : clk::time_point();
+	check_tmpl_args(tmpl_args);
+	epoch_guard guard;
+
+	// with a generic fallback, a failed specialization is not retried on each call (the fallback keeps being used instead)
+	bool generic = !have_tmpl_args && fn->generic && *fn->generic;
+	key_ref k(fn, have_tmpl_args, tmpl_args, call_args);
+	bool inserted;
+	cache_entry *e = find_or_insert(k, inserted, generic);
+	bool hit = stats && e->state.load(std::memory_order_acquire) == cache_entry::ready;
+	param_buffer params(e->num_params);
+	e->extract_params(inserted ? e->key.call_args : call_args, params.data); // the arguments were moved into the key if inserted
+
+	// until the specialization is ready, run the fallback and compile in the background
+	tagged_any args[max_generic_args];
+	if(generic && e->state.load(std::memory_order_acquire) != cache_entry::ready) {
+		if(generic_args(e->key, params.data, args)) {
+			if(inserted)
+				GLOBAL_compile_queue().push({&e, 1});
+			if((*fn->generic)(args, e->key.call_args.size())) {
+				if(stats)
+					e->stats.record_fallback();
+				return;
+			}
+			inserted = false; // already queued
+		} else if(!inserted) {
+			e = find_or_insert(k, inserted); // the arguments are still there, as the first lookup did not insert
+		}
+	}
+	if(inserted)
+		compile_entries({&e, 1});
+
+	touch(e);
+	if(e->num_params && e->state.load(std::memory_order_acquire) == cache_entry::ready) {
+		if(try_variant(e, params.data, stats, begin))
+			return;
+		profile_call(e, params.data);
+	}
+	if(stats && e->wait())
+		e->stats.record_call(hit, clk::now() - begin);
+	invoke(e, params.data);
+}
+
+doarr::specialization_future doarr::internal::compile_async(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args) {
+	auto params = params_of(tmpl_args, call_args);
+	epoch_guard guard;
+
+	// the future keeps the entry pinned
+	key_ref k(fn, have_tmpl_args, tmpl_args, call_args);
+	bool inserted;
+	cache_entry *e;
+	do e = find_or_insert(k, inserted); while(!pin(e)); // a newly inserted entry cannot fail to pin
+	if(inserted)
+		GLOBAL_compile_queue().push({&e, 1});
+
+	return specialization_future(e, std::move(params));
+}
+
+doarr::internal::bound_base doarr::internal::bind(const guest_fn *fn, bool have_tmpl_args, exprs &&tmpl_args, exprs &&call_args, const bool *is_slot) {
+	bound_base b;
+	b.params = params_of(tmpl_args, call_args);
+	b.num_params = exs::num_params(call_args);
+
+	// find where the slots are among the params
+	b.num_slots = std::count(is_slot, is_slot + call_args.size(), true);
+	b.slot_params = std::make_unique_for_overwrite<std::size_t[]>(b.num_slots);
+	b.direct = b.num_slots == b.num_params;
+	std::size_t param_idx = 0, slot_idx = 0;
+	for(const expr &arg : call_args) {
+		if(*is_slot++) {
+			b.direct &= param_idx == slot_idx;
+			b.slot_params[slot_idx++] = param_idx;
+		}
+		param_idx += exs::num_params(arg);
+	}
+
+	// the handle keeps the entry pinned
+	cache_entry *e;
+	{
+		epoch_guard guard;
+		key_ref k(fn, have_tmpl_args, tmpl_args, call_args);
+		bool inserted;
+		do e = find_or_insert(k, inserted); while(!pin(e)); // a newly inserted entry cannot fail to pin
+		if(inserted)
+			compile_entries({&e, 1});
+	}
+	if(!e->wait()) {
+		unpin(e);
+		std::rethrow_exception(e->error);
+	}
+	touch(e);
+	b.entry = e;
+	b.fn = (void(*)(const any *)) e->value.fn;
+	return b;
+}
+
+void doarr::internal::bound_base::invoke_indirect(const any *slot_values) const {
+	param_buffer merged(num_params);
+	std::copy_n(params.get(), num_params, merged.data);
+	for(std::size_t i = 0; i < num_slots; i++)
+		merged.data[slot_params[i]] = slot_values[i];
+	fn(merged.data);
+}
+
+doarr::internal::bound_base::~bound_base() {
+	if(entry)
+		unpin(entry);
+}
+
+
+
+void doarr::prepare_all(std::vector<request> &&requests) {
+	for(const auto &r : requests)
+		if(exs::num_params(r.tmpl_args))
+			throw std::logic_error("Template argument depends on a dynamic value");
+
+	epoch_guard guard;
+
+	// queue all the misses at once, so that they can be batched
+	std::vector<cache_entry *> entries, inserted_entries;
+	entries.reserve(requests.size());
+	for(auto &r : requests) {
+		bool inserted;
+		cache_entry *e = find_or_insert(key_ref(r.fn, r.have_tmpl_args, r.tmpl_args, r.call_args), inserted);
+		if(inserted)
+			inserted_entries.push_back(e);
+		entries.push_back(e);
+	}
+	GLOBAL_compile_queue().push(inserted_entries);
+
+	// wait for all of them, even if some fail early
+	const cache_entry *failed = nullptr;
+	for(const cache_entry *e : entries)
+		if(!e->wait() && !failed)
+			failed = e;
+	if(failed)
+		std::rethrow_exception(failed->error);
+}
+
+
 
-	auto [iter, miss] = GLOBAL_cache.try_emplace(cache_key(fn, have_tmpl_args, std::move(tmpl_args), std::move(call_args)));
-	auto &[k, v] = *iter;
-	if(miss) {
-		try {
-			compile(fn, have_tmpl_args, k, v);
-		} catch(...) {
-			GLOBAL_cache.erase(iter);
-			throw;
+void doarr::fuse(std::vector<request> &&requests) {
+	if(requests.empty())
+		return;
+	for(const auto &r : requests)
+		check_tmpl_args(r.tmpl_args);
+
+	// each request becomes a call expression, its dynamic values stay where they are
+	const guest_fn *first = requests.front().fn;
+	std::vector<void *> files;
+	std::vector<expr> calls;
+	calls.reserve(requests.size());
+	for(auto &r : requests) {
+		if(r.fn->file != first->file && std::ranges::find(files, r.fn->file) == files.end()) {
+			if(!doarr_can_include_source(fn_file(first), fn_file(r.fn)))
+				throw std::logic_error("Cannot fuse calls from guest files compiled with different flags (or with unknown sources)");
+			files.push_back(r.fn->file);
+		}
+		expr target = qname_expr(r.fn->name);
+		if(r.have_tmpl_args)
+			target = inst_expr(std::move(target), std::move(r.tmpl_args));
+		calls.push_back(call_expr(std::move(target), std::move(r.call_args)));
+	}
+	exprs no_tmpl_args, call_args;
+	exs::move_from(calls.data(), calls.size(), call_args);
+
+	epoch_guard guard;
+	key_ref k(first, files, no_tmpl_args, call_args);
+	bool inserted;
+	cache_entry *e = find_or_insert(k, inserted);
+	param_buffer params(e->num_params);
+	e->extract_params(inserted ? e->key.call_args : call_args, params.data); // the arguments were moved into the key if inserted
+	if(inserted)
+		compile_entries({&e, 1});
+	touch(e);
+	invoke(e, params.data);
+}
+
+
+
+namespace {
+
+// winners of doarr::autotune in this process, by the name of the tuning
+std::mutex GLOBAL_tuning_mutex;
+std::unordered_map<std::string, std::size_t> GLOBAL_tuning_winners;
+
+// a candidate of doarr::autotune, pinned while it exists
+struct tuning_candidate {
+	cache_entry *entry = nullptr;
+	std::unique_ptr<any[]> params;
+	double ns = 0; // median time of a run
+
+	~tuning_candidate() {
+		if(entry)
+			unpin(entry);
+	}
+};
+
+} // unnamed ns
+
+std::size_t doarr::autotune(std::vector<request> &&candidates, unsigned warmup, unsigned repetitions) {
+	if(candidates.empty())
+		throw std::logic_error("No candidates to autotune");
+	for(const auto &r : candidates)
+		check_tmpl_args(r.tmpl_args);
+	struct doarr_io_ctx *ctx = GLOBAL_io_ctx();
+
+	// the candidates are named by their specializations, as in the persistent cache
+	struct doarr_digest d;
+	doarr_digest_init(&d);
+	for(auto &r : candidates) {
+		key_ref k(r.fn, r.have_tmpl_args, r.tmpl_args, r.call_args);
+		entry_source src(k);
+		const char *const *extra_args = k.options ? k.options->argv.data() : nullptr;
+		std::size_t num_extra_args = k.options ? k.options->argv.size() : 0;
+		struct cache_name name;
+		doarr_cache_name(ctx, fn_file(r.fn), extra_args, num_extra_args, src.chars.get(), src.size, &name);
+		doarr_digest_update(&d, name.chars, cache_name_len);
+	}
+	struct cache_name tuning;
+	doarr_tuning_name(&d, &tuning);
+	{
+		std::lock_guard lock(GLOBAL_tuning_mutex);
+		auto it = GLOBAL_tuning_winners.find(tuning.chars);
+		if(it != GLOBAL_tuning_winners.end())
+			return it->second;
+	}
+	std::size_t winner;
+	if(!doarr_tuning_load(ctx, &tuning, &winner) && winner < candidates.size()) {
+		std::lock_guard lock(GLOBAL_tuning_mutex);
+		return GLOBAL_tuning_winners.emplace(tuning.chars, winner).first->second;
+	}
+
+	trace_phase tuning_phase("autotune");
+	auto tuned = std::make_unique<tuning_candidate[]>(candidates.size());
+	{
+		epoch_guard guard;
+
+		// compiled concurrently, as by prepare_all
+		std::vector<cache_entry *> inserted_entries;
+		for(std::size_t i = 0; i < candidates.size(); i++) {
+			auto &r = candidates[i];
+			tuned[i].params = params_of(r.tmpl_args, r.call_args);
+			key_ref k(r.fn, r.have_tmpl_args, r.tmpl_args, r.call_args);
+			bool inserted;
+			cache_entry *e;
+			do e = find_or_insert(k, inserted); while(!pin(e)); // a newly inserted entry cannot fail to pin
+			tuned[i].entry = e;
+			if(inserted)
+				inserted_entries.push_back(e);
+		}
+		GLOBAL_compile_queue().push(inserted_entries);
+	}
+
+	// those that fail to compile are left out, unless all of them do
+	const cache_entry *failed = nullptr;
+	std::vector<double> samples(std::max(repetitions, 1u));
+	winner = candidates.size();
+	for(std::size_t i = 0; i < candidates.size(); i++) {
+		cache_entry *e = tuned[i].entry;
+		if(!e->wait()) {
+			if(!failed)
+				failed = e;
+			continue;
+		}
+		touch(e);
+		for(unsigned j = 0; j < warmup; j++)
+			invoke(e, tuned[i].params.get());
+		for(double &sample : samples) {
+			auto begin = clk::now();
+			invoke(e, tuned[i].params.get());
+			sample = std::chrono::duration<double, std::nano>(clk::now() - begin).count();
 		}
+		std::ranges::nth_element(samples, samples.begin() + samples.size() / 2);
+		tuned[i].ns = samples[samples.size() / 2];
+		if(winner == candidates.size() || tuned[i].ns < tuned[winner].ns)
+			winner = i;
+	}
+	if(winner == candidates.size())
+		std::rethrow_exception(failed->error);
+	if(tuning_phase.enabled()) {
+		std::string detail;
+		for(std::size_t i = 0; i < candidates.size(); i++)
+			detail += describe(tuned[i].entry->key) + (tuned[i].ns ? ": " + std::to_string(tuned[i].ns) + " ns" : ": failed") + (i == winner ? " (winner)\n" : "\n");
+		tuning_phase.set_detail(std::move(detail));
+	}
+
+	doarr_tuning_store(ctx, &tuning, winner);
+	std::lock_guard lock(GLOBAL_tuning_mutex);
+	return GLOBAL_tuning_winners.emplace(tuning.chars, winner).first->second; // the first winner stays if several threads tuned at once
+}
+
+
+
+void doarr::specialization::operator()() const {
+	invoke(entry, params.get());
+}
+
+doarr::specialization::~specialization() {
+	if(entry)
+		unpin(entry);
+}
+
+doarr::specialization_future::~specialization_future() {
+	if(!entry)
+		return;
+	if(fd >= 0) {
+		remove_hook(entry, {doarr_notify_fd_signal, (void *) (std::intptr_t) fd});
+		doarr_notify_fd_close(fd);
 	}
-	((void(*)(const any *)) v.fn)(params);
+	if(awaiting) // destroyed while suspended, or after being resumed
+		remove_hook(entry, {resume_coroutine, awaiting});
+	unpin(entry);
+}
+
+bool doarr::specialization_future::ready() const noexcept {
+	return entry->state.load(std::memory_order_acquire) != cache_entry::compiling;
+}
+
+void doarr::specialization_future::wait() const noexcept {
+	entry->wait();
+}
+
+doarr::specialization doarr::specialization_future::get() && {
+	if(!entry->wait())
+		std::rethrow_exception(entry->error);
+	pin(entry); // cannot fail, already pinned by this
+	return specialization(entry, std::move(params));
+}
+
+int doarr::specialization_future::notify_fd() {
+	if(fd < 0) {
+		fd = doarr_notify_fd_create();
+		if(fd < 0)
+			throw std::system_error(errno, std::system_category(), "eventfd");
+		if(!add_hook(entry, {doarr_notify_fd_signal, (void *) (std::intptr_t) fd}))
+			doarr_notify_fd_signal((void *) (std::intptr_t) fd);
+	}
+	return fd;
+}
+
+bool doarr::specialization_future::await_suspend(std::coroutine_handle<> continuation) {
+	awaiting = continuation.address(); // before the hook can resume it (in another thread)
+	if(add_hook(entry, {resume_coroutine, awaiting}))
+		return true;
+	awaiting = nullptr;
+	return false;
+}
+
+
+
+void doarr::init() {
+	GLOBAL_io_ctx();
+}
+
+void doarr::set_compiler_options(std::string_view flags) {
+	auto &state = GLOBAL_options_state();
+	std::lock_guard lock(state.mutex);
+	state.global = state.intern(flags);
+	state.version.fetch_add(1, std::memory_order_release);
+}
+
+void doarr::internal::set_compiler_options(const guest_fn *fn, std::string_view flags) {
+	auto &state = GLOBAL_options_state();
+	std::lock_guard lock(state.mutex);
+	if(const compiler_options *options = state.intern(flags))
+		state.per_fn[fn] = options;
+	else
+		state.per_fn.erase(fn);
+	state.version.fetch_add(1, std::memory_order_release);
+}
+
+doarr::compiler_options_scope::compiler_options_scope(std::string_view flags) : outer(GLOBAL_scope_options) {
+	auto &state = GLOBAL_options_state();
+	std::lock_guard lock(state.mutex);
+	GLOBAL_scope_options = state.combine(outer, state.intern(flags));
+}
+
+doarr::compiler_options_scope::~compiler_options_scope() {
+	GLOBAL_scope_options = outer;
+}
+
+
+
+void doarr::set_cache_budget(std::size_t max_modules, std::size_t max_bytes) {
+	std::lock_guard lock(GLOBAL_cache_mutex);
+	auto &state = GLOBAL_cache_state();
+	state.max_modules = max_modules;
+	state.max_bytes = max_bytes;
+	enforce_budget();
+}
+
+void doarr::set_value_profiling(std::size_t calls) noexcept {
+	GLOBAL_profile_calls.store(calls, std::memory_order_relaxed);
+}
+
+doarr::cache_stats doarr::get_cache_stats() {
+	std::lock_guard lock(GLOBAL_cache_mutex);
+	auto &state = GLOBAL_cache_state();
+	return {
+		.modules = state.modules.size(),
+		.bytes = state.bytes,
+		.evictions = state.evictions,
+		.reloads = state.reloads,
+	};
+}
+
+
+
+void doarr::set_stats_enabled(bool enabled) noexcept {
+	GLOBAL_stats_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+doarr::runtime_stats doarr::stats() {
+	runtime_stats r{.cache = get_cache_stats(), .specializations = {}};
+	std::lock_guard lock(GLOBAL_cache_mutex);
+	cache_table *t = GLOBAL_cache.load(std::memory_order_relaxed);
+	if(!t)
+		return r;
+
+	std::unordered_map<const cache_entry *, const module *> modules;
+	for(const module *m : GLOBAL_cache_state().modules)
+		for(const cache_entry *e : m->entries)
+			modules[e] = m;
+
+	for(std::size_t i = 0; i <= t->mask; i++) {
+		const cache_entry *e = t->slots[i].load(std::memory_order_relaxed);
+		if(!e || e == cache_table::tombstone())
+			continue;
+		auto state = e->state.load(std::memory_order_acquire);
+		auto m = modules.find(e);
+		auto &s = r.specializations.emplace_back(specialization_stats{
+			.function = describe(e->key),
+			.state = state == cache_entry::compiling ? "compiling" : state == cache_entry::failed ? "failed" : "ready",
+			.compile_seconds = state == cache_entry::compiling ? 0 : e->compile_ns * 1e-9,
+			.from_disk_cache = state != cache_entry::compiling && e->from_disk,
+			.module_bytes = m != modules.end() ? m->second->size : 0,
+			.module_specializations = m != modules.end() ? m->second->entries.size() : 0,
+			.hits = e->stats.hits.load(std::memory_order_relaxed),
+			.misses = e->stats.misses.load(std::memory_order_relaxed),
+			.fallback_calls = e->stats.fallback_calls.load(std::memory_order_relaxed),
+			.overhead_ns_hist = {},
+		});
+		for(std::size_t b = 0; b < call_stats::num_buckets; b++)
+			s.overhead_ns_hist[b] = e->stats.overhead_hist[b].load(std::memory_order_relaxed);
+	}
+	return r;
+}
+
+void doarr::write_stats_json(std::FILE *out) {
+	auto r = stats();
+	std::fprintf(out, "{\n\t\"cache\": {\"modules\": %zu, \"bytes\": %zu, \"evictions\": %zu, \"reloads\": %zu},\n",
+		r.cache.modules, r.cache.bytes, r.cache.evictions, r.cache.reloads);
+	std::fputs("\t\"specializations\": [", out);
+	bool sep = false;
+	for(const auto &s : r.specializations) {
+		std::fputs(sep ? ",\n\t\t{\"function\": \"" : "\n\t\t{\"function\": \"", out);
+		doarr_json_escaped(out, s.function.c_str());
+		std::fprintf(out, "\", \"state\": \"%s\", \"compile_seconds\": %.6f, \"from_disk_cache\": %s, \"module_bytes\": %zu, \"module_specializations\": %zu",
+			s.state, s.compile_seconds, s.from_disk_cache ? "true" : "false", s.module_bytes, s.module_specializations);
+		std::fprintf(out, ", \"hits\": %llu, \"misses\": %llu, \"fallback_calls\": %llu, \"overhead_ns_hist\": [",
+			(unsigned long long) s.hits, (unsigned long long) s.misses, (unsigned long long) s.fallback_calls);
+		for(std::size_t b = 0; b < s.num_buckets; b++)
+			std::fprintf(out, b ? ", %llu" : "%llu", (unsigned long long) s.overhead_ns_hist[b]);
+		std::fputs("]}", out);
+		sep = true;
+	}
+	std::fputs(sep ? "\n\t]\n}\n" : "]\n}\n", out);
+}
+
+namespace {
+
+// DOARR_STATS=<path> enables the statistics and writes them to the path at exit
+const bool GLOBAL_stats_at_exit = [] {
+	if(!std::getenv("DOARR_STATS"))
+		return false;
+	GLOBAL_stats_enabled.store(true, std::memory_order_relaxed);
+	std::atexit([] {
+		const char *path = std::getenv("DOARR_STATS");
+		std::FILE *out = std::fopen(path, "w");
+		if(!out) {
+			std::perror(path);
+			return;
+		}
+		doarr::write_stats_json(out);
+		std::fclose(out);
+	});
+	return true;
+}();
+
 }
@@ -5,8 +5,13 @@
  * Common definitions for guest_file.h and io.h.
  */
 
+// <scratch dir>/doarr.XXXXXX/<13 letters>, null-terminated
 struct tmp_path {
-	char chars[32];
+	char chars[256];
+};
+
+struct doarr_digest {
+	unsigned long long lanes[2];
 };
 
 struct guest_file;
@@ -0,0 +1,44 @@
+#ifndef DIGEST_H_
+#define DIGEST_H_
+
+/*
+ * The digest for cache names, defined here so that dcc (which digests the guest source) and the runtime agree on it.
+ */
+
+#include "common.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static inline unsigned long long rotl64(unsigned long long x, int r) {
+	return x << r | x >> (64 - r);
+}
+
+static inline void digest_word(unsigned long long *a, unsigned long long *b, unsigned long long w) {
+	*a = rotl64((*a ^ w) * 0x9e3779b97f4a7c15ull, 29);
+	*b = rotl64((*b + w) * 0xc2b2ae3d27d4eb4full, 31) ^ *a;
+}
+
+static inline void doarr_digest_init(struct doarr_digest *d) {
+	d->lanes[0] = 0x243f6a8885a308d3ull;
+	d->lanes[1] = 0x13198a2e03707344ull;
+}
+
+static inline void doarr_digest_update(struct doarr_digest *d, const void *data, size_t size) {
+	unsigned long long a = d->lanes[0], b = d->lanes[1];
+	const unsigned char *p = (const unsigned char *) data, *end = p + size;
+	for(; end - p >= 8; p += 8) {
+		unsigned long long w;
+		memcpy(&w, p, 8);
+		digest_word(&a, &b, w);
+	}
+	// zero-padded tail, followed by the size (so that the padding is unambiguous)
+	unsigned long long tail = 0;
+	memcpy(&tail, p, end - p);
+	digest_word(&a, &b, tail);
+	digest_word(&a, &b, size);
+	d->lanes[0] = a;
+	d->lanes[1] = b;
+}
+
+#endif
@@ -3,7 +3,15 @@
 #include "expr_util.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
 
 #define FORWARD(E) decltype(E)(E)
 
@@ -11,6 +19,7 @@ using doarr::ExprNoexcept;
 using doarr::expr;
 using doarr::exprs;
 using doarr::internal::any;
+using doarr::internal::tagged_any;
 using doarr::internal::expr_impl;
 using doarr::internal::expr_impl_base;
 using namespace doarr::runtime;
@@ -34,6 +43,80 @@ constexpr expr_impl_base::expr_impl_base(std::size_t hash) noexcept : refcount(1
 // fully define expr_impl
 
 namespace {
+	// Nodes are mostly temporary (built for a call that hits the cache and freed right after it),
+	// so they are recycled through thread-local free lists (one per size class) instead of going to the allocator.
+	// A node freed by another thread than the one that allocated it joins the free list of the former.
+	constexpr std::size_t node_granule = 16, node_classes = 16, node_list_max = 256;
+
+	struct node_header {
+		alignas(std::max_align_t) std::size_t cls; // node_classes = not pooled
+	};
+
+	struct free_node {
+		free_node *next;
+	};
+
+	// trivially destructible, so that it stays usable while the thread-local objects of an exiting thread are destroyed
+	struct node_cache {
+		free_node *lists[node_classes];
+		std::size_t lengths[node_classes];
+		bool closed; // the thread is exiting, nodes are no longer kept
+	};
+
+	thread_local node_cache GLOBAL_node_cache;
+
+	struct node_cache_flusher {
+		~node_cache_flusher() {
+			auto &c = GLOBAL_node_cache;
+			c.closed = true;
+			for(std::size_t cls = 0; cls < node_classes; cls++) {
+				while(free_node *n = c.lists[cls]) {
+					c.lists[cls] = n->next;
+					::operator delete(n);
+				}
+				c.lengths[cls] = 0;
+			}
+		}
+	};
+
+	thread_local node_cache_flusher GLOBAL_node_cache_flusher; // constructed (and registered for thread exit) on first use
+
+	void *node_alloc(std::size_t size) {
+		std::size_t total = sizeof(node_header) + size;
+		std::size_t cls = (total - 1) / node_granule;
+		auto &c = GLOBAL_node_cache;
+		void *block;
+		if(cls >= node_classes) {
+			block = ::operator new(total);
+			cls = node_classes;
+		} else if(free_node *n = c.lists[cls]) {
+			c.lists[cls] = n->next;
+			c.lengths[cls]--;
+			block = n;
+		} else {
+			block = ::operator new((cls + 1) * node_granule);
+		}
+		return new (block) node_header{cls} + 1;
+	}
+
+	void node_free(void *ptr) noexcept {
+		auto *h = (node_header *) ptr - 1;
+		std::size_t cls = h->cls;
+		auto &c = GLOBAL_node_cache;
+		if(cls >= node_classes || c.closed || c.lengths[cls] >= node_list_max) {
+			::operator delete(h);
+			return;
+		}
+		if(!c.lengths[cls])
+			(void) &GLOBAL_node_cache_flusher;
+		c.lists[cls] = new (h) free_node{c.lists[cls]};
+		c.lengths[cls]++;
+	}
+
+	// allocates a node with the given number of chars after it
+	struct trailing_chars {
+		std::size_t count;
+	};
 	struct expr_impl_class {
 		bool (*const are_equal)(const expr_impl &a, const expr_impl &b);
 	};
@@ -47,6 +130,7 @@ namespace {
 struct doarr::internal::expr_impl : expr_impl_base {
 	const expr_impl_class *const cls;
 	const std::size_t num_params;
+	bool interned = false; // see intern_table
 
 	explicit expr_impl() = delete;
 	constexpr explicit expr_impl(const expr_impl_class *cls, std::size_t hash, std::size_t num_params) noexcept : expr_impl_base(hash), cls(cls), num_params(num_params) {}
@@ -57,9 +141,20 @@ struct doarr::internal::expr_impl : expr_impl_base {
 
 	virtual any *extract_params(any *) = 0;
 	virtual std::size_t write_to(std::FILE *, std::size_t) const = 0;
+	virtual bool eval(const any *&params, tagged_any *out) const = 0;
+	virtual expr with_literals(const expr &self, const any *&params, bool *&fixed) const = 0; // see exs::with_literals
+	virtual void plan_params(std::vector<std::uint32_t> &path, std::vector<std::uint32_t> &out) const = 0; // see exs::plan_params
 	virtual ~expr_impl() = default;
 
+	static void *operator new(std::size_t size) { return node_alloc(size); }
+	static void *operator new(std::size_t size, trailing_chars extra) { return node_alloc(size + extra.count); }
+	static void operator delete(void *ptr) noexcept { node_free(ptr); }
+	static void operator delete(void *ptr, trailing_chars) noexcept { node_free(ptr); }
+
 	constexpr std::size_t get_hash() noexcept { return hash; }
+
+	void make_immortal() noexcept { refcount = immortal; }
+	void make_mortal() noexcept { refcount = 1; }
 };
 
 
@@ -91,7 +186,7 @@ bool operator ==(const expr &a, const expr &b) noexcept {
 	auto *ap = a.operator->(), *bp = b.operator->();
 	if(ap == bp)
 		return true;
-	if(ap->get_hash() != bp->get_hash())
+	if(ap->get_hash() != bp->get_hash() || ap->interned && bp->interned)
 		return false;
 	auto cls = ap->cls;
 	if(cls != bp->cls)
@@ -122,6 +217,10 @@ std::size_t hash(const exprs &es) noexcept {
 
 
 
+std::size_t exs::num_params(const expr &e) noexcept {
+	return e->num_params;
+}
+
 std::size_t exs::num_params(const exprs &es) noexcept {
 	std::size_t sum = 0;
 	for(const expr &e : es)
@@ -135,6 +234,24 @@ doarr::internal::any *exs::extract_params(const exprs &es, any *out) noexcept {
 	return out;
 }
 
+bool exs::eval(const exprs &es, const any *params, tagged_any *out) noexcept {
+	for(const expr &e : es)
+		if(!e->eval(params, out++))
+			return false;
+	return true;
+}
+
+std::size_t exs::write_to(const expr &e, std::FILE *out, std::size_t param_idx) noexcept {
+	return e->write_to(out, param_idx);
+}
+
+void exs::move_from(expr *items, std::size_t num_items, exprs &out) {
+	if(num_items > exprs::inline_capacity)
+		out.items = new expr[num_items];
+	out.num_items = num_items;
+	std::move(items, items + num_items, out.items);
+}
+
 std::size_t exs::write_to(const exprs &es, std::FILE *out, std::size_t param_idx) noexcept {
 	bool sep = false;
 	for(const expr &e : es) {
@@ -172,6 +289,30 @@ static constexpr std::size_t hash_str(const char *str, std::size_t len) noexcept
 	return r;
 }
 
+// Steps of a path in a plan (see exs::plan_params): to the expr member at an offset in the node,
+// or (with the lowest bit set) to an item of the exprs member at an offset, the index of the item is the next word.
+
+void plan_child(const expr_impl *node, const expr &child, std::vector<std::uint32_t> &path, std::vector<std::uint32_t> &out) {
+	if(!child->num_params)
+		return;
+	path.push_back((std::uint32_t) ((const char *) &child - (const char *) node) << 1);
+	child->plan_params(path, out);
+	path.pop_back();
+}
+
+void plan_children(const expr_impl *node, const exprs &children, std::vector<std::uint32_t> &path, std::vector<std::uint32_t> &out) {
+	std::uint32_t i = 0;
+	for(const expr &child : children) {
+		if(child->num_params) {
+			path.push_back((std::uint32_t) ((const char *) &children - (const char *) node) << 1 | 1);
+			path.push_back(i);
+			child->plan_params(path, out);
+			path.resize(path.size() - 2);
+		}
+		i++;
+	}
+}
+
 struct dyn_expr_impl final : expr_impl {
 	const char tag;
 	const any value;
@@ -194,8 +335,54 @@ struct dyn_expr_impl final : expr_impl {
 		std::fprintf(out, "DOARR_EXPORT[%zu].%c", param_idx++, tag);
 		return param_idx;
 	}
+
+	bool eval(const any *&params, tagged_any *out) const override {
+		*out = {*params++, tag};
+		return true;
+	}
+
+	void plan_params(std::vector<std::uint32_t> &path, std::vector<std::uint32_t> &out) const override {
+		out.push_back((std::uint32_t) path.size());
+		out.insert(out.end(), path.begin(), path.end());
+	}
+
+	expr with_literals(const expr &self, const any *&params, bool *&fixed) const override; // defined below, needs raw_expr and interned
 };
 
+}
+
+// these need dyn_expr_impl
+
+void exs::plan_params(const exprs &es, std::vector<std::uint32_t> &out) {
+	std::vector<std::uint32_t> path;
+	std::uint32_t i = 0;
+	for(const expr &e : es) {
+		if(e->num_params) {
+			path.push_back(i);
+			e->plan_params(path, out);
+			path.pop_back();
+		}
+		i++;
+	}
+}
+
+void exs::extract_planned_params(const exprs &es, const std::uint32_t *plan, std::size_t num_params, any *out) noexcept {
+	const expr *items = es.begin();
+	for(std::size_t i = 0; i < num_params; i++) {
+		const std::uint32_t *end = plan + 1 + *plan;
+		plan++;
+		const expr_impl *node = items[*plan++].operator->();
+		while(plan != end) {
+			std::uint32_t step = *plan++;
+			const char *member = (const char *) node + (step >> 1);
+			node = (step & 1 ? ((const exprs *) member)->begin()[*plan++] : *(const expr *) member).operator->();
+		}
+		out[i] = static_cast<const dyn_expr_impl *>(node)->value;
+	}
+}
+
+namespace {
+
 struct call_expr_impl final : expr_impl {
 	const expr fn;
 	const exprs args;
@@ -219,6 +406,11 @@ struct call_expr_impl final : expr_impl {
 		return out;
 	}
 
+	void plan_params(std::vector<std::uint32_t> &path, std::vector<std::uint32_t> &out) const override {
+		plan_child(this, fn, path, out);
+		plan_children(this, args, path, out);
+	}
+
 	std::size_t write_to(std::FILE *out, std::size_t param_idx) const override {
 		param_idx = fn->write_to(out, param_idx);
 		std::fputc(lbr, out);
@@ -226,6 +418,12 @@ struct call_expr_impl final : expr_impl {
 		std::fputc(rbr, out);
 		return param_idx;
 	}
+
+	bool eval(const any *&, tagged_any *) const override {
+		return false;
+	}
+
+	expr with_literals(const expr &self, const any *&params, bool *&fixed) const override; // defined below, needs raw_expr and interned
 };
 
 struct infix_expr_impl final : expr_impl {
@@ -248,6 +446,11 @@ struct infix_expr_impl final : expr_impl {
 		return out;
 	}
 
+	void plan_params(std::vector<std::uint32_t> &path, std::vector<std::uint32_t> &out) const override {
+		plan_child(this, left, path, out);
+		plan_child(this, right, path, out);
+	}
+
 	std::size_t write_to(std::FILE *out, std::size_t param_idx) const override {
 		std::fputc('(', out);
 		param_idx = left->write_to(out, param_idx);
@@ -256,14 +459,23 @@ struct infix_expr_impl final : expr_impl {
 		std::fputc(')', out);
 		return param_idx;
 	}
+
+	bool eval(const any *&, tagged_any *) const override {
+		return false;
+	}
+
+	expr with_literals(const expr &self, const any *&params, bool *&fixed) const override; // defined below, needs raw_expr and interned
 };
 
 struct raw_expr_impl final : expr_impl {
-	const std::unique_ptr<char[]> code;
+	// stored right after the node, see make
+	const char *code() const noexcept {
+		return (const char *) (this + 1);
+	}
 
 	static constexpr expr_impl_class cls = make_expr_impl_class<raw_expr_impl, decltype([](const raw_expr_impl &a, const raw_expr_impl &b) {
-		const char *ap = a.code.get();
-		const char *bp = b.code.get();
+		const char *ap = a.code();
+		const char *bp = b.code();
 		for(;;) {
 			if(*ap != *bp)
 				return false;
@@ -273,21 +485,140 @@ struct raw_expr_impl final : expr_impl {
 		}
 	})>;
 
-	explicit raw_expr_impl(const char *code, std::size_t len) : expr_impl(&cls, hash_all((std::size_t) &cls, hash_str(code, len)), 0), code(new char[len]) {
-		for(std::size_t i = 0; i < len; i++)
-			this->code[i] = code[i];
+	explicit raw_expr_impl(const char *code, std::size_t len) : expr_impl(&cls, hash_of(code, len), 0) {
+		std::copy_n(code, len, (char *) (this + 1));
+	}
+
+	static std::size_t hash_of(const char *code, std::size_t len) noexcept {
+		return hash_all((std::size_t) &cls, hash_str(code, len));
+	}
+
+	static raw_expr_impl *make(const char *code, std::size_t len) {
+		return new (trailing_chars{len}) raw_expr_impl(code, len);
 	}
 
 	any *extract_params(any *out) override {
 		return out;
 	}
 
+	void plan_params(std::vector<std::uint32_t> &, std::vector<std::uint32_t> &) const override {}
+
 	std::size_t write_to(std::FILE *out, std::size_t param_idx) const override {
-		std::fputs(code.get(), out);
+		std::fputs(code(), out);
 		return param_idx;
 	}
+
+	// only the literals made by int_expr and char_expr
+	bool eval(const any *&, tagged_any *out) const override {
+		const char *p = code();
+		if(p[0] == '\'' && p[1] && p[2] == '\'' && !p[3]) {
+			*out = {any{.i = (std::size_t) p[1]}, 'i'};
+			return true;
+		}
+		if(*p < '0' || *p > '9')
+			return false;
+		std::size_t value = 0;
+		for(; *p; p++) {
+			if(*p < '0' || *p > '9')
+				return false;
+			value = value * 10 + (*p - '0');
+		}
+		*out = {any{.i = value}, 'i'};
+		return true;
+	}
+
+	expr with_literals(const expr &self, const any *&, bool *&) const override {
+		return self;
+	}
 };
 
+// With DOARR_INTERN=1, constant nodes (those without dynamic values) are kept unique in a global insert-only table and never freed,
+// so that equal subtrees share one node (and compare by pointer) and repeated literals are not built again.
+// DOARR_INTERN_MAX limits the number of nodes (65536 by default), further nodes are not interned (and compare by value).
+class intern_table {
+	const std::size_t max_nodes, mask;
+	std::atomic<std::size_t> num_nodes = 0;
+	const std::unique_ptr<std::atomic<expr_impl *>[]> slots;
+
+	explicit intern_table(std::size_t max_nodes) :
+		max_nodes(max_nodes),
+		mask(std::bit_ceil(2 * max_nodes) - 1),
+		slots(new std::atomic<expr_impl *>[mask + 1]()) {}
+
+public:
+	// null if disabled
+	static intern_table *get() {
+		static intern_table *instance = []() -> intern_table * {
+			const char *enabled = std::getenv("DOARR_INTERN");
+			if(!enabled || !*enabled || !std::strcmp(enabled, "0"))
+				return nullptr;
+			const char *max = std::getenv("DOARR_INTERN_MAX");
+			std::size_t max_nodes = max ? std::strtoull(max, nullptr, 10) : 65536;
+			return max_nodes ? new intern_table(max_nodes) : nullptr; // leaked, like the nodes
+		}();
+		return instance;
+	}
+
+	// Returns the interned node for which equal returns true, or interns the one returned by make (if there is still room).
+	// In the latter case, the result is the node from make. If it loses a race with an equal node, it stays owned by the caller.
+	expr_impl *find_or_insert(std::size_t hash, auto &&equal, auto &&make) {
+		expr_impl *node = nullptr;
+		for(std::size_t i = hash;; i++) {
+			auto &slot = slots[i & mask];
+			expr_impl *e = slot.load(std::memory_order_acquire);
+			if(!e) {
+				if(!node) {
+					if(num_nodes.fetch_add(1, std::memory_order_relaxed) >= max_nodes)
+						return make();
+					node = make();
+					node->interned = true;
+					node->make_immortal();
+				}
+				if(slot.compare_exchange_strong(e, node, std::memory_order_acq_rel, std::memory_order_acquire))
+					return node;
+			}
+			if(e->get_hash() == hash && equal(e)) {
+				if(node) {
+					node->interned = false;
+					node->make_mortal();
+					num_nodes.fetch_sub(1, std::memory_order_relaxed);
+				}
+				return e;
+			}
+		}
+	}
+};
+
+expr interned(expr &&node) {
+	intern_table *t = intern_table::get();
+	if(!t || node->num_params)
+		return std::move(node);
+	expr_impl *n = node.operator->();
+	expr_impl *e = t->find_or_insert(n->get_hash(), [n](expr_impl *e) { return e->cls == n->cls && n->cls->are_equal(*e, *n); }, [n] { return n; });
+	if(e == n)
+		return std::move(node);
+	return expr{e}; // immortal, node is freed
+}
+
+expr raw_expr(const char *code, std::size_t len) {
+	expr node{nullptr};
+	auto make = [&] {
+		node = expr{raw_expr_impl::make(code, len)};
+		return node.operator->();
+	};
+	intern_table *t = intern_table::get();
+	if(!t) {
+		make();
+		return node;
+	}
+	expr_impl *e = t->find_or_insert(raw_expr_impl::hash_of(code, len), [code](expr_impl *e) {
+		return e->cls == &raw_expr_impl::cls && !std::strcmp(((const raw_expr_impl *) e)->code(), code);
+	}, make);
+	if(e == node.operator->())
+		return node;
+	return expr{e}; // immortal, node (if any) is freed
+}
+
 }
 
 
@@ -307,53 +638,50 @@ expr doarr::dyn_expr(void *value) {
 
 
 expr doarr::call_expr(const expr &fn, exprs &&args) {
-	return expr{new call_expr_impl(FORWARD(fn), FORWARD(args), '(', ')')};
+	return interned(expr{new call_expr_impl(FORWARD(fn), FORWARD(args), '(', ')')});
 }
 
 expr doarr::call_expr(expr &&fn, exprs &&args) {
-	return expr{new call_expr_impl(FORWARD(fn), FORWARD(args), '(', ')')};
+	return interned(expr{new call_expr_impl(FORWARD(fn), FORWARD(args), '(', ')')});
 }
 
 expr doarr::inst_expr(const expr &tmpl, exprs &&args) {
-	return expr{new call_expr_impl(FORWARD(tmpl), FORWARD(args), '<', '>')};
+	return interned(expr{new call_expr_impl(FORWARD(tmpl), FORWARD(args), '<', '>')});
 }
 
 expr doarr::inst_expr(expr &&tmpl, exprs &&args) {
-	return expr{new call_expr_impl(FORWARD(tmpl), FORWARD(args), '<', '>')};
+	return interned(expr{new call_expr_impl(FORWARD(tmpl), FORWARD(args), '<', '>')});
 }
 
 
 
 expr doarr::infix_expr(const infix_op &op, const expr &left, const expr &right) {
-	return expr{new infix_expr_impl(op, FORWARD(left), FORWARD(right))};
+	return interned(expr{new infix_expr_impl(op, FORWARD(left), FORWARD(right))});
 }
 
 expr doarr::infix_expr(const infix_op &op, const expr &left, expr &&right) {
-	return expr{new infix_expr_impl(op, FORWARD(left), FORWARD(right))};
+	return interned(expr{new infix_expr_impl(op, FORWARD(left), FORWARD(right))});
 }
 
 expr doarr::infix_expr(const infix_op &op, expr &&left, const expr &right) {
-	return expr{new infix_expr_impl(op, FORWARD(left), FORWARD(right))};
+	return interned(expr{new infix_expr_impl(op, FORWARD(left), FORWARD(right))});
 }
 
 expr doarr::infix_expr(const infix_op &op, expr &&left, expr &&right) {
-	return expr{new infix_expr_impl(op, FORWARD(left), FORWARD(right))};
+	return interned(expr{new infix_expr_impl(op, FORWARD(left), FORWARD(right))});
 }
 
 
 
-expr doarr::char_expr(char value) {
-	// easy to be represented as char literal?
-	if(value >= 32 && value < 127 && value != '\'' && value != '\\') {
-		char lit[] = "'_'";
-		lit[1] = value;
-		return expr{new raw_expr_impl(lit, sizeof lit)};
-	} else {
-		return int_expr(value);
-	}
+namespace {
+
+// makes a new node (or an interned one) never freed, to be shared between threads without refcounting
+expr immortal(expr &&node) noexcept {
+	node->make_immortal();
+	return std::move(node);
 }
 
-expr doarr::int_expr(std::size_t value) {
+expr int_literal(std::size_t value) {
 	char str[3 * sizeof value + 1];
 	char *p = str + sizeof str;
 	*--p = '\0';
@@ -361,7 +689,96 @@ expr doarr::int_expr(std::size_t value) {
 		*--p = '0' + value % 10;
 		value /= 10;
 	} while(value);
-	return expr{new raw_expr_impl(p, str + sizeof str - p)};
+	return raw_expr(p, str + sizeof str - p);
+}
+
+expr char_literal(char value) {
+	// easy to be represented as char literal?
+	if(value >= 32 && value < 127 && value != '\'' && value != '\\') {
+		char lit[] = "'_'";
+		lit[1] = value;
+		return raw_expr(lit, sizeof lit);
+	} else {
+		return int_literal(value);
+	}
+}
+
+// the most common literals, built once and immortal
+struct small_literals {
+	static constexpr std::size_t num_ints = 256, num_chars = 128;
+	expr_impl *ints[num_ints];
+	expr_impl *chars[num_chars];
+
+	small_literals() {
+		for(std::size_t i = 0; i < num_ints; i++)
+			ints[i] = immortal(int_literal(i)).operator->();
+		for(std::size_t i = 0; i < num_chars; i++)
+			chars[i] = immortal(char_literal((char) i)).operator->();
+	}
+};
+
+const small_literals &GLOBAL_small_literals() {
+	static const small_literals instance;
+	return instance;
+}
+
+}
+
+expr doarr::char_expr(char value) {
+	if((unsigned char) value < small_literals::num_chars)
+		return expr{GLOBAL_small_literals().chars[(unsigned char) value]};
+	return char_literal(value);
+}
+
+expr doarr::int_expr(std::size_t value) {
+	if(value < small_literals::num_ints)
+		return expr{GLOBAL_small_literals().ints[value]};
+	return int_literal(value);
+}
+
+
+
+namespace {
+
+// a literal of the type of the dynamic integers (DOARR_EXPORT[i].i), so that it fits wherever they did
+expr size_literal(std::size_t value) {
+	char str[3 * sizeof value + sizeof "std::size_t{}"];
+	int len = std::snprintf(str, sizeof str, "std::size_t{%zu}", value);
+	return raw_expr(str, len + 1);
+}
+
+expr dyn_expr_impl::with_literals(const expr &self, const any *&params, bool *&fixed) const {
+	any value = *params++;
+	bool &f = *fixed++;
+	f = f && tag == 'i';
+	return f ? size_literal(value.i) : self;
+}
+
+expr call_expr_impl::with_literals(const expr &self, const any *&params, bool *&fixed) const {
+	if(!num_params)
+		return self;
+	expr new_fn = fn->with_literals(fn, params, fixed);
+	exprs new_args;
+	exs::with_literals(args, params, fixed, new_args);
+	return ::interned(expr{new call_expr_impl(std::move(new_fn), std::move(new_args), lbr, rbr)});
+}
+
+expr infix_expr_impl::with_literals(const expr &self, const any *&params, bool *&fixed) const {
+	if(!num_params)
+		return self;
+	expr new_left = left->with_literals(left, params, fixed);
+	expr new_right = right->with_literals(right, params, fixed);
+	return ::interned(expr{new infix_expr_impl(op, std::move(new_left), std::move(new_right))});
+}
+
+}
+
+void exs::with_literals(const exprs &es, const any *&params, bool *&fixed, exprs &out) {
+	if(es.num_items > exprs::inline_capacity)
+		out.items = new expr[es.num_items];
+	out.num_items = es.num_items;
+	for(std::size_t i = 0; i < es.num_items; i++)
+		out.items[i] = es.items[i]->num_params ? es.items[i]->with_literals(es.items[i], params, fixed) : es.items[i];
 }
 
 namespace {
@@ -411,5 +828,9 @@ expr doarr::qname_expr(const char *name) {
 		std::fprintf(stderr, "Invalid qualified name: %s\n", name);
 		std::abort();
 	}
-	return expr{new raw_expr_impl(name, end - name)};
+	return raw_expr(name, end - name);
+}
+
+expr doarr::static_qname_expr(const char *name) {
+	return immortal(qname_expr(name));
 }
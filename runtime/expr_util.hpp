@@ -8,16 +8,30 @@
 #include <doarr/expr_base.hpp>
 #include <doarr/any_.hpp>
 
+#include <cstdint>
 #include <cstdio>
+#include <vector>
 
 namespace doarr {
 
 namespace runtime {
 
 struct INTERNAL_VISIBILITY exs {
+	static std::size_t num_params(const expr &e) noexcept;
 	static std::size_t num_params(const exprs &es) noexcept;
 	static internal::any *extract_params(const exprs &es, internal::any *out) noexcept;
+	// Appends to out the path to each dynamic value in es (the number of words, the index in es, then the steps down the nested nodes).
+	// The result is a plan for extract_planned_params, valid for any exprs equal to es (their nodes have the same layout).
+	static void plan_params(const exprs &es, std::vector<std::uint32_t> &out);
+	static void extract_planned_params(const exprs &es, const std::uint32_t *plan, std::size_t num_params, internal::any *out) noexcept;
 	static std::size_t write_to(const exprs &es, std::FILE *out, std::size_t param_idx) noexcept;
+	static std::size_t write_to(const expr &e, std::FILE *out, std::size_t param_idx) noexcept;
+	static void move_from(expr *items, std::size_t num_items, exprs &out); // out must be empty
+	// evaluates expressions that are literals or dynamic values (taken from params, see extract_params), returns false on any other
+	static bool eval(const exprs &es, const internal::any *params, internal::tagged_any *out) noexcept;
+	// Copies es into out (empty) with the dynamic integers flagged in fixed replaced by literals of their values from params (see extract_params),
+	// clears the flags of the other dynamic values, and advances both pointers past the params of es.
+	static void with_literals(const exprs &es, const internal::any *&params, bool *&fixed, exprs &out);
 };
 
 //
@@ -13,7 +13,14 @@ struct guest_file {
 	const char *const *compiler_args;
 	int num_compiler_args;
 	int pos_between_args;
+	const char *source_path; // absolute path of the guest source ("" if unknown), included instead of the precompiled header if that does not match the flags
+	struct doarr_digest source_digest; // of the guest source when dcc compiled it, the runtime only uses the file at source_path while it still matches
+	int source_state; // 0 if not checked yet, 1 if the file still matches source_digest, -1 if not (or unknown)
 	struct tmp_path gch_tmp_path;
+	const char *gch_march; // the -march the precompiled header at gch_tmp_path was built for, or NULL if it is the one from dcc
+	struct doarr_digest gch_digest;
+	int have_gch_digest;
+	int building_gch; // a precompiled header for the file is being built with the mutex unlocked (see extract_variant_locked)
 };
 
 #endif
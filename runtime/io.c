@@ -1,14 +1,28 @@
+#define _GNU_SOURCE // dlinfo, dl_iterate_phdr
+
 #include "io.h"
 #include "guest_file.h"
+#include "trace.h"
+#ifdef DOARR_ORC
+#include "orc.h"
+#endif
 
 #include <dlfcn.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <link.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -24,11 +38,258 @@
 #define noinline
 #endif
 
-static const struct tmp_path tmp_path_template = {"/tmp/doarr.XXXXXX\0aaaaaaaaaaaaa"};
+#ifdef DOARR_ORC
+// modules linked by the ORC backend are told apart from dlopen handles by the lowest bit
+static void *orc_handle(void *module) {
+	return (void *) ((uintptr_t) module | 1);
+}
+
+static void *orc_module(void *handle) {
+	return (uintptr_t) handle & 1 ? (void *) ((uintptr_t) handle - 1) : NULL;
+}
+#endif
+
+static const char tmp_dir_template[] = "/doarr.XXXXXX";
+static const char tmp_counter_init[] = "/aaaaaaaaaaaaa";
+
+// the scratch directory (DOARR_TMPDIR, /tmp by default) holds the extracted precompiled headers and, unless diskless, the sources and shared objects
+static const char *scratch_dir(void) {
+	const char *dir = getenv("DOARR_TMPDIR");
+	return dir && *dir ? dir : "/tmp";
+}
+
+static bool env_flag(const char *name, bool default_value) {
+	const char *value = getenv(name);
+	if(!value || !*value)
+		return default_value;
+	return strcmp(value, "0") != 0;
+}
+
+static const char *open_cache_dir(void) {
+	const char *dir = getenv("DOARR_CACHE_DIR");
+	if(!dir || !*dir)
+		return NULL;
+	if(mkdir(dir, 0700) && errno != EEXIST) {
+		perror("Persistent cache disabled: mkdir");
+		return NULL;
+	}
+	return strdup(dir);
+}
+
+static void try_remove(const char *file_name) {
+	if(unlink(file_name))
+		perror("unlink");
+}
+
+// the precompiled headers are shared by all processes of the user, in <scratch dir>/doarr-pch.<uid>, named by their digest
+static const char *open_pch_dir(const char *scratch) {
+	if(!env_flag("DOARR_SHARED_PCH", true))
+		return NULL;
+	char *dir = malloc(strlen(scratch) + 3 * sizeof(long) + 12);
+	if(!dir)
+		return NULL;
+	sprintf(dir, "%s/doarr-pch.%ld", scratch, (long) getuid());
+	if(strlen(dir) + cache_name_len + tmp_ext_size + 1 > tmp_path_size) {
+		free(dir);
+		return NULL;
+	}
+	if(mkdir(dir, 0700) && errno != EEXIST) {
+		perror("Shared precompiled headers disabled: mkdir");
+		free(dir);
+		return NULL;
+	}
+	struct stat st;
+	if(lstat(dir, &st) || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077)) {
+		fprintf(stderr, "Shared precompiled headers disabled: %s is not a private directory\n", dir);
+		free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+// the x86-64 microarchitecture level of this CPU, judged by the features that tell the levels apart in practice
+static const char *detect_march(void) {
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512cd")
+		&& __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl"))
+		return "-march=x86-64-v4";
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("fma"))
+		return "-march=x86-64-v3";
+	if(__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+		return "-march=x86-64-v2";
+#endif
+	return NULL; // nothing to gain over the default
+}
+
+// the -march flag the specializations are compiled with (DOARR_MARCH=<arch> overrides the detected one, DOARR_MARCH=0 disables it), or NULL
+static const char *open_march(void) {
+	const char *march = getenv("DOARR_MARCH");
+	if(!march || !*march)
+		return detect_march();
+	if(!strcmp(march, "0"))
+		return NULL;
+	char *arg = malloc(strlen(march) + sizeof "-march=");
+	if(arg)
+		sprintf(arg, "-march=%s", march);
+	return arg;
+}
+
+static int full_write(int fd, const unsigned char *begin, const unsigned char *end) {
+	while(begin != end) {
+		ssize_t w = write(fd, begin, end - begin);
+		if(w == -1 || w == 0)
+			return -1;
+		begin += w;
+	}
+	return 0;
+}
+
+enum {
+	launcher_max_request = 64 * 1024, // the null-separated compiler argv
+};
+
+static noinline noreturn void execute_compiler(const char *const *argv) {
+	const char *compiler_name = *argv;
+
+	execv(compiler_name, (char **) argv);
+
+	// execve only returns on error
+	perror("Error while executing compiler: execv");
+
+	_exit(127);
+}
+
+// runs in a child of the launcher: starts the compiler, waits for it and reports {si_code, si_status} to reply_fd
+static noreturn void watch_compiler(const char *const *argv, int reply_fd) {
+	// the launcher ignores SIGCHLD, which would make waitid fail
+	signal(SIGCHLD, SIG_DFL);
+	pid_t pid = fork();
+	if(pid == -1) {
+		perror("Error while executing compiler: fork");
+		_exit(127);
+	}
+	if(pid == 0)
+		execute_compiler(argv);
+	siginfo_t info;
+	if(waitid(P_PID, pid, &info, WEXITED)) {
+		perror("waitid");
+		_exit(127);
+	}
+	int result[2] = {info.si_code, info.si_status};
+	if(full_write(reply_fd, (const unsigned char *) result, (const unsigned char *) (result + 1) + sizeof *result) < 0)
+		perror("Compiler launcher: write");
+	_exit(0);
+}
+
+// the main loop of the launcher process, exits when the host closes its end of the socket
+static noreturn void run_launcher(int sock) {
+	static char request[launcher_max_request];
+	// children (the watchers) are reaped automatically
+	signal(SIGCHLD, SIG_IGN);
+	for(;;) {
+		union {
+			struct cmsghdr header;
+			char bytes[CMSG_SPACE(sizeof(int))];
+		} control;
+		struct iovec iov = {request, sizeof request - 1};
+		struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = &control, .msg_controllen = sizeof control};
+		ssize_t size = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+		if(size < 0 && errno == EINTR)
+			continue;
+		if(size <= 0)
+			_exit(0);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if(!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue; // no reply fd, the host will see EOF
+		int reply_fd;
+		memcpy(&reply_fd, CMSG_DATA(cmsg), sizeof reply_fd);
+
+		request[size] = '\0';
+		size_t argc = 0;
+		for(ssize_t i = 0; i < size; i++)
+			argc += !request[i];
+		const char *argv[argc + 1]; // VLA!
+		{
+			const char *arg = request;
+			for(size_t i = 0; i < argc; i++, arg += strlen(arg) + 1)
+				argv[i] = arg;
+			argv[argc] = NULL;
+		}
+
+		if(fork() == 0) {
+			close(sock);
+			watch_compiler(argv, reply_fd);
+		}
+		// on fork failure, closing the reply fd reports the error to the host
+		close(reply_fd);
+	}
+}
+
+// forks the launcher, which spawns compilers on behalf of the host, so that the host itself never has to fork with its (possibly huge) address space
+// returns the host end of the socket, or -1 if disabled or failed (then the host forks by itself)
+static int start_launcher(int reaper_fd, const char *compiler_tmp_dir) {
+	if(!env_flag("DOARR_LAUNCHER", true))
+		return -1;
+
+	int socks[2];
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, socks)) {
+		perror("Compiler launcher disabled: socketpair");
+		return -1;
+	}
+	switch(fork()) {
+		case -1: { // error
+			perror("Compiler launcher disabled: fork");
+			close(socks[0]);
+			close(socks[1]);
+			return -1;
+		}
+		case 0: { // child
+			// the reaper must not wait for the launcher
+			close(reaper_fd);
+			close(socks[0]);
+			// the compilers' own temporary files go to the scratch directory as well
+			if(compiler_tmp_dir)
+				setenv("TMPDIR", compiler_tmp_dir, 1);
+			run_launcher(socks[1]);
+			for(;;);
+		}
+		default: { // parent
+			close(socks[1]);
+			return socks[0];
+		}
+	}
+}
 
 int doarr_io_init(struct doarr_io_ctx *ctx) {
-	ctx->tmp_path = tmp_path_template;
+	if(pthread_mutex_init(&ctx->mutex, NULL) || pthread_cond_init(&ctx->gch_built, NULL)) {
+		fputs("Could not initialize mutex\n", stderr);
+		return -1;
+	}
+	// the path must be absolute, the generated sources include the precompiled header by it
+	char *dir = realpath(scratch_dir(), NULL);
+	if(!dir) {
+		perror("Could not find the scratch directory: realpath");
+		return -1;
+	}
+	if(strlen(dir) + sizeof tmp_dir_template + sizeof tmp_counter_init - 2 >= tmp_path_size) {
+		fprintf(stderr, "Scratch directory path too long: %s\n", dir);
+		free(dir);
+		return -1;
+	}
+	ctx->cache_dir = open_cache_dir();
+	ctx->pch_dir = open_pch_dir(dir);
+	ctx->march = open_march();
+	ctx->diskless = env_flag("DOARR_DISKLESS", false);
+#ifdef DOARR_ORC
+	ctx->orc = env_flag("DOARR_ORC", true);
+#else
+	ctx->orc = 0;
+#endif
 	char *tmp_path = ctx->tmp_path.chars;
+	sprintf(tmp_path, "%s%s", dir, tmp_dir_template);
+	free(dir);
 
 	if(!mkdtemp(tmp_path)) {
 		perror("Could not create temporary directory: mkdtemp");
@@ -86,10 +347,14 @@ int doarr_io_init(struct doarr_io_ctx *ctx) {
 		}
 	}
 
-	tmp_path[strlen(tmp_path)] = '/';
+	// with DOARR_TMPDIR, the compilers also put their own temporary files into the temporary directory (so the reaper removes them)
+	ctx->launcher_fd = start_launcher(fds[1], getenv("DOARR_TMPDIR") ? tmp_path : NULL);
+
+	strcat(tmp_path, tmp_counter_init);
 	return 0;
 }
 
+// must be called with ctx->mutex locked
 static void tmp_path_inc(struct doarr_io_ctx *ctx) {
 	// increment in big-endian base26 with digits 'a'..'z', prefixed with '/', examples:
 	// - .../aaaa -> .../aaab
@@ -97,8 +362,8 @@ static void tmp_path_inc(struct doarr_io_ctx *ctx) {
 	// - .../iizz -> .../ijaa
 	// - .../zzzz -> *abort*
 
-	// point to the last character (size-1 is null terminator)
-	char *c = &ctx->tmp_path.chars[tmp_path_size - 2];
+	// point to the last character
+	char *c = &ctx->tmp_path.chars[strlen(ctx->tmp_path.chars) - 1];
 
 	// replace trailing 'z's with 'a's (like replacing trailing 9s with 0s in decimal)
 	while(*c == 'z')
@@ -112,138 +377,846 @@ static void tmp_path_inc(struct doarr_io_ctx *ctx) {
 	(*c)++;
 }
 
-static int full_write(int fd, const unsigned char *begin, const unsigned char *end) {
-	while(begin != end) {
-		ssize_t w = write(fd, begin, end - begin);
-		if(w == -1 || w == 0)
-			return -1;
-		begin += w;
+static struct tmp_path next_tmp_path(struct doarr_io_ctx *ctx) {
+	pthread_mutex_lock(&ctx->mutex);
+	struct tmp_path path = ctx->tmp_path;
+	tmp_path_inc(ctx);
+	pthread_mutex_unlock(&ctx->mutex);
+	return path;
+}
+
+static void tmp_full_path(const struct tmp_path *path, const char ext[tmp_ext_size], struct tmp_full_path *out_path) {
+	size_t len = strlen(path->chars);
+	memcpy(out_path->chars, path->chars, len);
+	memcpy(out_path->chars + len, ext, tmp_ext_size);
+}
+
+// the path of the memfd as seen by any process (the compiler is not a child of this process if the launcher runs it)
+static int memfd_path(const char *name, char *out_path) {
+	int fd = memfd_create(name, MFD_CLOEXEC);
+	if(fd < 0) {
+		perror("memfd_create");
+		return -1;
 	}
-	return 0;
+	sprintf(out_path, "/proc/%ld/fd/%d", (long) getpid(), fd);
+	return fd;
 }
 
-void doarr_tmp_path(struct doarr_io_ctx *ctx, const char ext[tmp_ext_size], struct tmp_full_path *out_path) {
-	memcpy(out_path->chars, ctx->tmp_path.chars, tmp_path_len);
-	memcpy(out_path->chars + tmp_path_len, ext, tmp_ext_size);
-	tmp_path_inc(ctx);
+FILE *doarr_source_create(struct doarr_io_ctx *ctx, struct doarr_source *out_src) {
+	int fd;
+	if(ctx->diskless) {
+		out_src->fd = memfd_path("doarr.cxx", out_src->name.chars);
+		if(out_src->fd < 0)
+			return NULL;
+		// the memfd stays open until compiled, the stream gets its own descriptor
+		fd = dup(out_src->fd);
+	} else {
+		out_src->fd = -1;
+		struct tmp_path path = next_tmp_path(ctx);
+		tmp_full_path(&path, ".cxx", &out_src->name);
+		fd = open(out_src->name.chars, O_WRONLY|O_CLOEXEC|O_CREAT|O_EXCL|O_NOFOLLOW, 0600);
+	}
+	FILE *out = fd < 0 ? NULL : fdopen(fd, "w");
+	if(!out) {
+		perror("Cannot write source");
+		if(fd >= 0)
+			close(fd);
+		if(out_src->fd >= 0)
+			close(out_src->fd);
+		else
+			unlink(out_src->name.chars);
+	}
+	return out;
 }
 
-const char *doarr_extract_precompiled_or_null(struct doarr_io_ctx *ctx, struct guest_file *file) {
-	if(*file->gch_tmp_path.chars)
-		return file->gch_tmp_path.chars;
+static unsigned long long fmix64(unsigned long long k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
 
-	struct tmp_path path = ctx->tmp_path;
-	struct tmp_full_path full_path;
-	doarr_tmp_path(ctx, ".gch", &full_path);
+static void digest_name(const struct doarr_digest *d, struct cache_name *out_name) {
+	unsigned long long a = d->lanes[0], b = d->lanes[1];
+	sprintf(out_name->chars, "%016llx%016llx", fmix64(a + b), fmix64(a ^ rotl64(b, 17)));
+}
+
+// must be called with ctx->mutex locked
+static const struct doarr_digest *gch_digest_locked(struct guest_file *file) {
+	if(!file->have_gch_digest) {
+		doarr_digest_init(&file->gch_digest);
+		doarr_digest_update(&file->gch_digest, file->gch_data, file->gch_data_end - file->gch_data);
+		file->have_gch_digest = 1;
+	}
+	return &file->gch_digest;
+}
+
+static bool digest_source(const char *source_path, struct doarr_digest *out_digest) {
+	int fd = open(source_path, O_RDONLY|O_CLOEXEC);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st)) {
+		if(fd >= 0)
+			close(fd);
+		return false;
+	}
+	void *data = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : (void *) "";
+	close(fd);
+	if(data == MAP_FAILED)
+		return false;
+	doarr_digest_init(out_digest);
+	doarr_digest_update(out_digest, data, st.st_size);
+	if(st.st_size)
+		munmap(data, st.st_size);
+	return true;
+}
+
+// Whether the file at source_path is still the guest source dcc compiled (only the file itself, not the headers it includes).
+// Checked once, with ctx->mutex unlocked, before anything compiles the file instead of the precompiled header.
+static bool source_unchanged(struct doarr_io_ctx *ctx, struct guest_file *file) {
+	pthread_mutex_lock(&ctx->mutex);
+	int state = file->source_state;
+	pthread_mutex_unlock(&ctx->mutex);
+	if(state)
+		return state > 0;
+
+	struct doarr_digest d;
+	const char *source = file->source_path;
+	state = *source && !strpbrk(source, "\"\n") && digest_source(source, &d) && !memcmp(&d, &file->source_digest, sizeof d) ? 1 : -1;
+	pthread_mutex_lock(&ctx->mutex);
+	if(!file->source_state && state < 0 && *source)
+		fprintf(stderr, "Guest source changed since it was compiled, not used instead of the precompiled header: %s\n", source);
+	file->source_state = state;
+	pthread_mutex_unlock(&ctx->mutex);
+	return state > 0;
+}
 
-	int fd = open(full_path.chars, O_WRONLY|O_CLOEXEC|O_CREAT|O_EXCL|O_NOFOLLOW, 0400);
+struct image_query {
+	ElfW(Addr) addr;
+	size_t size;
+	off_t offset;
+	bool found;
+};
+
+static int find_image_offset(struct dl_phdr_info *info, size_t info_size, void *data) {
+	(void) info_size;
+	struct image_query *q = data;
+	for(ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+		ElfW(Addr) begin = info->dlpi_addr + ph->p_vaddr;
+		if(ph->p_type != PT_LOAD || q->addr < begin || q->addr - begin >= ph->p_filesz)
+			continue;
+		// only the main program can be reopened reliably (by /proc/self/exe), a shared object may have been replaced on disk
+		q->found = !*info->dlpi_name && q->addr - begin + q->size <= ph->p_filesz;
+		q->offset = ph->p_offset + (q->addr - begin);
+		return 1; // stop
+	}
+	return 0; // continue
+}
+
+// copies the data of the executable into fd in the kernel (without reading it through user memory), returns the number of bytes copied
+static size_t copy_from_image(int fd, const unsigned char *begin, const unsigned char *end) {
+	struct image_query q = {(ElfW(Addr)) begin, end - begin, 0, false};
+	dl_iterate_phdr(find_image_offset, &q);
+	if(!q.found)
+		return 0;
+	int image_fd = open("/proc/self/exe", O_RDONLY|O_CLOEXEC);
+	if(image_fd < 0)
+		return 0;
+	size_t copied = 0;
+	while(copied < q.size) {
+		ssize_t c = copy_file_range(image_fd, &q.offset, fd, NULL, q.size - copied, 0);
+		if(c <= 0)
+			break;
+		copied += c;
+	}
+	close(image_fd);
+	return copied;
+}
+
+// creates the file with the precompiled header, the caller removes it on failure
+static bool write_precompiled(const char *file_name, const struct guest_file *file) {
+	int fd = open(file_name, O_WRONLY|O_CLOEXEC|O_CREAT|O_EXCL|O_NOFOLLOW, 0400);
 	if(fd < 0) {
 		perror("Cannot extract precompiled header: open");
-		return NULL;
+		return false;
 	}
-	if(full_write(fd, file->gch_data, file->gch_data_end) < 0) {
+	// the rest (all of it if the kernel cannot copy it) goes through write
+	size_t copied = copy_from_image(fd, file->gch_data, file->gch_data_end);
+	if(full_write(fd, file->gch_data + copied, file->gch_data_end) < 0) {
 		perror("Cannot extract precompiled header: write");
-		return NULL;
+		close(fd);
+		return false;
 	}
 	if(close(fd) < 0) {
 		perror("Cannot extract precompiled header: close after write");
-		return NULL;
+		return false;
 	}
+	return true;
+}
 
-	file->gch_tmp_path = path;
-	return file->gch_tmp_path.chars;
+// The header the generated sources include, found by the compiler only if the precompiled header does not match the flags
+// (e.g. -ffast-math or -O0 from set_compiler_options): it includes the guest source instead, if unchanged (see source_unchanged).
+// Creates the file (the caller removes it on failure), or nothing if the source is unknown or changed.
+static bool write_fallback_header(const char *file_name, const struct guest_file *file) {
+	const char *source = file->source_path;
+	if(file->source_state <= 0)
+		return true;
+	int fd = open(file_name, O_WRONLY|O_CLOEXEC|O_CREAT|O_EXCL|O_NOFOLLOW, 0400);
+	FILE *out = fd < 0 ? NULL : fdopen(fd, "w");
+	if(!out) {
+		perror("Cannot write fallback header");
+		if(fd >= 0)
+			close(fd);
+		return false;
+	}
+	fprintf(out, "#include \"%s\"\n", source);
+	if(fclose(out)) {
+		perror("Cannot write fallback header: fclose");
+		return false;
+	}
+	return true;
+}
+
+// writes the file under a temporary name and renames it, atomically replacing whatever may have been published meanwhile (it must be equivalent)
+static bool publish_shared(const char *file_name, bool (*write_fn)(const char *, const struct guest_file *), const struct guest_file *file) {
+	char tmp_name[tmp_full_path_size + 3 * sizeof(long) + 6];
+	sprintf(tmp_name, "%s.%ld.tmp", file_name, (long) getpid());
+	if(!write_fn(tmp_name, file)) {
+		unlink(tmp_name);
+		return false;
+	}
+	if(access(tmp_name, F_OK))
+		return true; // nothing written
+	if(rename(tmp_name, file_name)) {
+		perror("Cannot share precompiled header: rename");
+		try_remove(tmp_name);
+		return false;
+	}
+	return true;
 }
 
-static noinline noreturn void execute_compiler(const char *cxx_file_name, const char *so_file_name, const struct guest_file *file) {
+// reuses (or publishes) the precompiled header in the shared directory, named by its digest
+static bool extract_shared_locked(struct doarr_io_ctx *ctx, struct guest_file *file, struct tmp_path *out_path) {
+	struct cache_name name;
+	digest_name(gch_digest_locked(file), &name);
+	sprintf(out_path->chars, "%s/%s", ctx->pch_dir, name.chars);
+	struct tmp_full_path full_path;
+	tmp_full_path(out_path, ".gch", &full_path);
+
+	// only published (i.e. complete) files can have these names
+	if(access(out_path->chars, F_OK) && !publish_shared(out_path->chars, write_fallback_header, file))
+		return false;
+	struct stat st;
+	if(!stat(full_path.chars, &st) && st.st_size == file->gch_data_end - file->gch_data)
+		return true;
+	return publish_shared(full_path.chars, write_precompiled, file);
+}
+
+enum {
+	max_extra_args = 16, // on top of the compiler args from dcc and the extra args
+};
+
+// extra_args (see set_compiler_options in call_.hpp) go after those from dcc, so that they can override them
+static void compiler_argv(const char *cxx_file_name, bool diskless, bool object, const char *so_file_name, const struct guest_file *file, const char *const *extra_args, size_t num_extra_args, const char **argv) {
 	size_t n = file->num_compiler_args;
-	const char *argv[n + 4]; // VLA!
-	{
-		size_t k = file->pos_between_args;
-		const char *const *in_arg = file->compiler_args, **out_arg = argv;
-		for(size_t i = 0; i < k; i++)
-			*out_arg++ = *in_arg++;
+	size_t k = file->pos_between_args;
+	const char *const *in_arg = file->compiler_args, **out_arg = argv;
+	for(size_t i = 0; i < k; i++)
+		*out_arg++ = *in_arg++;
+	if(diskless) {
+		// the memfd path has no extension to tell the language, and -pipe keeps the assembly out of temporary files
+		*out_arg++ = "-pipe";
+		*out_arg++ = "-xc++";
+		*out_arg++ = cxx_file_name;
+		*out_arg++ = "-xnone";
+	} else {
 		*out_arg++ = cxx_file_name;
-		for(size_t i = k; i < n; i++)
-			*out_arg++ = *in_arg++;
-		*out_arg++ = "-o";
-		*out_arg++ = so_file_name;
-		*out_arg++ = NULL;
 	}
+	for(size_t i = k; i < n; i++)
+		*out_arg++ = *in_arg++;
+	if(file->gch_march)
+		*out_arg++ = file->gch_march;
+	// reports the precompiled headers that do not match the flags, i.e. when the fallback header is used
+	*out_arg++ = "-Winvalid-pch";
+	*out_arg++ = "-Wno-error=invalid-pch";
+	for(size_t i = 0; i < num_extra_args; i++)
+		*out_arg++ = extra_args[i];
+	if(object)
+		*out_arg++ = "-c"; // overrides -shared
+	*out_arg++ = "-o";
+	*out_arg++ = so_file_name;
+	*out_arg++ = NULL;
+}
 
-	const char *compiler_name = *argv;
-
-	execv(compiler_name, (char **) argv);
+// returns 0 and the compiler's {si_code, si_status}, 1 if the compiler could not be run, or -1 if the launcher is not usable
+static int launch(int launcher_fd, const char *const *argv, int result[2]) {
+	size_t size = 0;
+	for(const char *const *arg = argv; *arg; arg++)
+		size += strlen(*arg) + 1;
+	if(size >= launcher_max_request)
+		return -1;
+	char request[size]; // VLA!
+	{
+		char *out = request;
+		for(const char *const *arg = argv; *arg; arg++)
+			out = stpcpy(out, *arg) + 1;
+	}
 
-	// execve only returns on error
-	perror("Error while executing compiler: execv");
+	int fds[2];
+	if(pipe2(fds, O_CLOEXEC)) {
+		perror("pipe2");
+		return -1;
+	}
+	union {
+		struct cmsghdr header;
+		char bytes[CMSG_SPACE(sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof control);
+	struct iovec iov = {request, size};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = &control, .msg_controllen = sizeof control};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fds[1], sizeof(int));
+	ssize_t sent;
+	do
+		sent = sendmsg(launcher_fd, &msg, MSG_NOSIGNAL);
+	while(sent < 0 && errno == EINTR);
+	close(fds[1]);
+	if(sent < 0) {
+		close(fds[0]);
+		return -1;
+	}
 
-	_exit(127);
+	// the launcher's child writes the result once the compiler exits, or closes the pipe on failure
+	unsigned char *begin = (unsigned char *) result, *end = begin + 2 * sizeof *result;
+	while(begin != end) {
+		ssize_t r = read(fds[0], begin, end - begin);
+		if(r < 0 && errno == EINTR)
+			continue;
+		if(r <= 0)
+			break;
+		begin += r;
+	}
+	close(fds[0]);
+	if(begin != end) {
+		fputs("Error while executing compiler: the launcher failed\n", stderr);
+		return 1;
+	}
+	return 0;
 }
 
-static bool compile(const char *cxx_file_name, const char *so_file_name, const struct guest_file *file) {
-	pid_t pid = fork();
-	switch(pid) {
-		case -1: { // error
-			perror("Error while executing compiler: fork");
-			return false;
-		}
-		case 0: { // child
-			execute_compiler(cxx_file_name, so_file_name, file);
-			for(;;);
-		}
-		default: { // parent
-			siginfo_t info;
-			if(waitid(P_PID, pid, &info, WEXITED)) {
-				perror("waitid");
+static bool run_compiler(const struct doarr_io_ctx *ctx, const char *const *argv) {
+	int status[2];
+	int launched = ctx->launcher_fd < 0 ? -1 : launch(ctx->launcher_fd, argv, status);
+	if(launched == 1)
+		return false;
+	if(launched < 0) {
+		// no launcher, fork the host
+		pid_t pid = fork();
+		switch(pid) {
+			case -1: { // error
+				perror("Error while executing compiler: fork");
 				return false;
 			}
-			if(info.si_code == CLD_EXITED) {
-				if(info.si_status == 0) {
-					return true;
-				} else {
-					fprintf(stderr, "Compiler exited with status %i\n", (int) info.si_status);
+			case 0: { // child
+				execute_compiler(argv);
+				for(;;);
+			}
+			default: { // parent
+				siginfo_t info;
+				if(waitid(P_PID, pid, &info, WEXITED)) {
+					perror("waitid");
 					return false;
 				}
-			} else { // signal
-				fprintf(stderr, "Compiler killed by signal %i\n", (int) info.si_status);
-				return false;
+				status[0] = info.si_code;
+				status[1] = info.si_status;
+				break;
 			}
 		}
 	}
+
+	if(status[0] == CLD_EXITED) {
+		if(status[1] == 0) {
+			return true;
+		} else {
+			fprintf(stderr, "Compiler exited with status %i\n", status[1]);
+			return false;
+		}
+	} else { // signal
+		fprintf(stderr, "Compiler killed by signal %i\n", status[1]);
+		return false;
+	}
 }
 
-static void try_remove(const char *file_name) {
-	if(unlink(file_name))
-		perror("unlink");
+static bool compile(const struct doarr_io_ctx *ctx, const struct doarr_source *src, bool object, const char *so_file_name, const struct guest_file *file, const char *const *extra_args, size_t num_extra_args) {
+	const char *argv[file->num_compiler_args + num_extra_args + max_extra_args]; // VLA!
+	compiler_argv(src->name.chars, src->fd >= 0, object, so_file_name, file, extra_args, num_extra_args, argv);
+	return run_compiler(ctx, argv);
 }
 
-int doarr_compile_and_load(struct doarr_io_ctx *ctx, struct tmp_full_path *cxx_file_name, const struct guest_file *file, void **out_handle, void **out_fn) {
-	struct tmp_path so_file_name = ctx->tmp_path;
-	tmp_path_inc(ctx);
+// builds the precompiled header from the guest source, with the same args as the one from dcc, except for -march
+static bool build_precompiled(const struct doarr_io_ctx *ctx, const char *gch_file_name, const struct guest_file *file) {
+	size_t n = file->num_compiler_args;
+	size_t k = file->pos_between_args;
+	const char *argv[n + max_extra_args]; // VLA!
+	const char *const *in_arg = file->compiler_args, **out_arg = argv;
+	for(size_t i = 0; i < k; i++)
+		*out_arg++ = *in_arg++;
+	*out_arg++ = "-xc++-header";
+	*out_arg++ = file->source_path;
+	*out_arg++ = "-xnone";
+	for(size_t i = k; i < n; i++)
+		*out_arg++ = *in_arg++;
+	*out_arg++ = ctx->march;
+	*out_arg++ = "-o";
+	*out_arg++ = gch_file_name;
+	*out_arg++ = NULL;
 
-	// compile c++ to shared library
-	bool compiled_ok = compile(cxx_file_name->chars, so_file_name.chars, file);
-	try_remove(cxx_file_name->chars);
-	if(!compiled_ok)
-		return 1;
+	unsigned long long trace = doarr_trace_begin();
+	bool ok = run_compiler(ctx, argv);
+	doarr_trace_end(trace, "build_pch", gch_file_name);
+	return ok;
+}
 
-	// load shared library
-	void *handle = dlopen(so_file_name.chars, RTLD_NOW);
+// runs build_precompiled with ctx->mutex unlocked, the other threads extracting the file wait for it (the other files go on)
+static bool build_precompiled_locked(struct doarr_io_ctx *ctx, const char *gch_file_name, struct guest_file *file) {
+	file->building_gch = 1;
+	pthread_mutex_unlock(&ctx->mutex);
+	bool ok = build_precompiled(ctx, gch_file_name, file);
+	pthread_mutex_lock(&ctx->mutex);
+	file->building_gch = 0;
+	pthread_cond_broadcast(&ctx->gch_built);
+	return ok;
+}
+
+// The precompiled header from dcc only matches its own -march, so that for ctx->march is built from the guest source on first use (if unchanged).
+// It is named by the digest of the one from dcc, the flag and the source, and shared like the one from dcc (if enabled).
+static bool extract_variant_locked(struct doarr_io_ctx *ctx, struct guest_file *file, struct tmp_path *out_path) {
+	if(!ctx->pch_dir) {
+		*out_path = ctx->tmp_path;
+		tmp_path_inc(ctx);
+		struct tmp_full_path full_path;
+		tmp_full_path(out_path, ".gch", &full_path);
+		if(!build_precompiled_locked(ctx, full_path.chars, file))
+			return false;
+		write_fallback_header(out_path->chars, file); // optional, the error is reported
+		return true;
+	}
+
+	struct doarr_digest d = *gch_digest_locked(file);
+	doarr_digest_update(&d, ctx->march, strlen(ctx->march));
+	doarr_digest_update(&d, file->source_path, strlen(file->source_path));
+	doarr_digest_update(&d, &file->source_digest, sizeof file->source_digest);
+	struct cache_name name;
+	digest_name(&d, &name);
+	sprintf(out_path->chars, "%s/%s", ctx->pch_dir, name.chars);
+	struct tmp_full_path full_path;
+	tmp_full_path(out_path, ".gch", &full_path);
+
+	// only published (i.e. complete) files can have these names
+	if(access(out_path->chars, F_OK) && !publish_shared(out_path->chars, write_fallback_header, file))
+		return false;
+	if(!access(full_path.chars, F_OK))
+		return true;
+	char tmp_name[tmp_full_path_size + 3 * sizeof(long) + 6];
+	sprintf(tmp_name, "%s.%ld.tmp", full_path.chars, (long) getpid());
+	if(!build_precompiled_locked(ctx, tmp_name, file)) {
+		unlink(tmp_name);
+		return false;
+	}
+	if(rename(tmp_name, full_path.chars)) {
+		perror("Cannot share precompiled header: rename");
+		try_remove(tmp_name);
+		return false;
+	}
+	return true;
+}
+
+// Whether the specializations of the file use the precompiled header for ctx->march, decided before it is built (see doarr_cache_name).
+// If the build fails, they are compiled for the -march from dcc, which also runs on CPUs like this one.
+static bool uses_variant(struct doarr_io_ctx *ctx, struct guest_file *file) {
+	return source_unchanged(ctx, file) && ctx->march;
+}
+
+static const char *extract_precompiled_locked(struct doarr_io_ctx *ctx, struct guest_file *file, bool variant) {
+	while(file->building_gch)
+		pthread_cond_wait(&ctx->gch_built, &ctx->mutex);
+	if(*file->gch_tmp_path.chars)
+		return file->gch_tmp_path.chars;
+
+	unsigned long long trace = doarr_trace_begin();
+	struct tmp_path path;
+	if(variant && extract_variant_locked(ctx, file, &path)) {
+		file->gch_march = ctx->march;
+	} else if(!ctx->pch_dir || *file->source_path && file->source_state < 0 || !extract_shared_locked(ctx, file, &path)) {
+		// private copy in the temporary directory (the shared one may have a fallback header from before the source changed)
+		path = ctx->tmp_path;
+		tmp_path_inc(ctx);
+		struct tmp_full_path full_path;
+		tmp_full_path(&path, ".gch", &full_path);
+		if(!write_precompiled(full_path.chars, file))
+			return NULL;
+		write_fallback_header(path.chars, file); // optional, the error is reported
+	}
+
+	file->gch_tmp_path = path;
+	doarr_trace_end(trace, "extract_pch", path.chars);
+	return file->gch_tmp_path.chars;
+}
+
+const char *doarr_extract_precompiled_or_null(struct doarr_io_ctx *ctx, struct guest_file *file) {
+	bool variant = uses_variant(ctx, file); // also checks the source for the fallback header
+	// the returned path is never modified once set, so it may be used after unlocking
+	pthread_mutex_lock(&ctx->mutex);
+	const char *result = extract_precompiled_locked(ctx, file, variant);
+	pthread_mutex_unlock(&ctx->mutex);
+	return result;
+}
+
+int doarr_can_include_source(const struct guest_file *file, const struct guest_file *other) {
+	if(!*other->source_path || strpbrk(other->source_path, "\"\n"))
+		return 0;
+	if(file->num_compiler_args != other->num_compiler_args || file->pos_between_args != other->pos_between_args)
+		return 0;
+	for(int i = 0; i < file->num_compiler_args; i++)
+		if(strcmp(file->compiler_args[i], other->compiler_args[i]))
+			return 0;
+	return 1;
+}
+
+void doarr_write_source_include(struct doarr_io_ctx *ctx, struct guest_file *file, FILE *out) {
+	// named by the digest of the precompiled header, so that the persistent cache key covers the version of the source
+	struct cache_name name;
+	pthread_mutex_lock(&ctx->mutex);
+	digest_name(gch_digest_locked(file), &name);
+	pthread_mutex_unlock(&ctx->mutex);
+	fprintf(out, "#ifndef DOARR_INCLUDED_%s\n#define DOARR_INCLUDED_%s\n#include \"%s\"\n#endif\n", name.chars, name.chars, file->source_path);
+}
+
+static const char *tmp_basename(const struct tmp_path *path) {
+	return strrchr(path->chars, '/') + 1;
+}
+
+static void *load(const char *so_file_name) {
+	unsigned long long trace = doarr_trace_begin();
+	void *handle = dlopen(so_file_name, RTLD_NOW);
 	if(!handle)
 		fprintf(stderr, "dlopen: %s\n", dlerror());
-	try_remove(so_file_name.chars);
-	if(!handle)
-		return 2;
+	doarr_trace_end(trace, "dlopen", so_file_name);
+	return handle;
+}
+
+struct module_size_query {
+	ElfW(Addr) base;
+	size_t size;
+};
+
+static int sum_loaded_segments(struct dl_phdr_info *info, size_t info_size, void *data) {
+	(void) info_size;
+	struct module_size_query *q = data;
+	if(info->dlpi_addr != q->base)
+		return 0; // continue
+	for(ElfW(Half) i = 0; i < info->dlpi_phnum; i++)
+		if(info->dlpi_phdr[i].p_type == PT_LOAD)
+			q->size += info->dlpi_phdr[i].p_memsz;
+	return 1; // stop
+}
+
+size_t doarr_module_size(void *handle) {
+#ifdef DOARR_ORC
+	if(orc_module(handle))
+		return doarr_orc_size(orc_module(handle));
+#endif
+	struct link_map *map;
+	if(dlinfo(handle, RTLD_DI_LINKMAP, &map))
+		return 0;
+	struct module_size_query q = {map->l_addr, 0};
+	dl_iterate_phdr(sum_loaded_segments, &q);
+	return q.size;
+}
+
+// returns the memfd the module was loaded from, or -1
+static int module_memfd(void *handle) {
+	struct link_map *map;
+	if(dlinfo(handle, RTLD_DI_LINKMAP, &map))
+		return -1;
+	long pid;
+	int fd, end = 0;
+	if(sscanf(map->l_name, "/proc/%ld/fd/%d%n", &pid, &fd, &end) != 2 || map->l_name[end] || pid != (long) getpid())
+		return -1;
+	return fd;
+}
+
+void doarr_module_unload(void *handle) {
+#ifdef DOARR_ORC
+	if(orc_module(handle)) {
+		doarr_orc_unload(orc_module(handle));
+		return;
+	}
+#endif
+	// the memfd is kept open while loaded, so that no other module gets the same name (dlopen would mistake it for this one)
+	int fd = module_memfd(handle);
+	if(dlclose(handle))
+		fprintf(stderr, "dlclose: %s\n", dlerror());
+	if(fd >= 0)
+		close(fd);
+}
+
+void *doarr_lookup_symbol(void *handle, const char *symbol) {
+#ifdef DOARR_ORC
+	if(orc_module(handle))
+		return doarr_orc_lookup(orc_module(handle), symbol);
+#endif
+	return dlsym(handle, symbol);
+}
 
-	// lookup generated entry point
-	void *fn = dlsym(handle, "DOARR_EXPORT");
+int doarr_lookup_entry(void *handle, size_t index, void **out_fn) {
+	char symbol[sizeof "DOARR_EXPORT_" + 3 * sizeof index];
+	sprintf(symbol, "DOARR_EXPORT_%zu", index);
+	unsigned long long trace = doarr_trace_begin();
+	void *fn;
+#ifdef DOARR_ORC
+	if(orc_module(handle)) {
+		fn = doarr_orc_lookup(orc_module(handle), symbol);
+		doarr_trace_end(trace, "orc_lookup", symbol);
+		if(!fn)
+			return 2;
+		*out_fn = fn;
+		return 0;
+	}
+#endif
+	fn = dlsym(handle, symbol);
+	doarr_trace_end(trace, "dlsym", symbol);
 	if(!fn) {
 		fprintf(stderr, "dlsym: %s\n", dlerror());
-		dlclose(handle);
 		return 2;
 	}
+	*out_fn = fn;
+	return 0;
+}
+
+// atomically replaces whatever may have been published meanwhile (it must be equivalent)
+static void publish(const char *dir, const char *output, const struct cache_name *name, const char *tmp_suffix) {
+	char tmp_name[strlen(dir) + cache_name_len + strlen(tmp_suffix) + 2]; // VLA!
+	char published_name[strlen(dir) + cache_name_len + 5]; // VLA!
+	sprintf(tmp_name, "%s/%s%s", dir, name->chars, tmp_suffix);
+	sprintf(published_name, "%s/%s.so", dir, name->chars);
+	unsigned long long trace = doarr_trace_begin();
+	if(link(output, tmp_name)) {
+		perror("Cannot publish to persistent cache: link");
+		return;
+	}
+	if(rename(tmp_name, published_name)) {
+		perror("Cannot publish to persistent cache: rename");
+		try_remove(tmp_name);
+	}
+	doarr_trace_end(trace, "publish", published_name);
+}
+
+int doarr_compile_and_load(struct doarr_io_ctx *ctx, struct doarr_source *src, const struct guest_file *file, const char *const *extra_args, size_t num_extra_args, const struct cache_name *publish_as, size_t num_publish, void **out_handle) {
+	struct tmp_path so_tmp_path = next_tmp_path(ctx);
+
+	// when publishing, compile directly into the cache directory, so that the links cannot cross file systems
+	const char *dir = num_publish ? ctx->cache_dir : NULL;
+	char tmp_suffix[3 * sizeof(long) + tmp_path_size + 8];
+	sprintf(tmp_suffix, ".%ld.%s.tmp", (long) getpid(), tmp_basename(&so_tmp_path));
+	char so_file_name[dir ? strlen(dir) + sizeof tmp_suffix + 7 : 3 * sizeof(long) + 3 * sizeof(int) + 12]; // VLA!
+	int so_fd = -1;
+	if(dir)
+		sprintf(so_file_name, "%s/batch%s", dir, tmp_suffix);
+	else if(ctx->diskless)
+		so_fd = memfd_path("doarr.so", so_file_name);
+	const char *output = dir || so_fd >= 0 ? so_file_name : so_tmp_path.chars;
+
+	// compile c++ to shared library (or to an object for the ORC backend, which cannot publish)
+	bool object = ctx->orc && !dir;
+	unsigned long long trace = doarr_trace_begin();
+	bool compiled_ok = compile(ctx, src, object, output, file, extra_args, num_extra_args);
+	doarr_trace_end(trace, "compile", src->name.chars);
+	if(src->fd >= 0)
+		close(src->fd);
+	else
+		try_remove(src->name.chars);
+	if(!compiled_ok) {
+		if(so_fd >= 0)
+			close(so_fd);
+		else if(unlink(output) && errno != ENOENT)
+			perror("unlink");
+		return 1;
+	}
+
+#ifdef DOARR_ORC
+	if(object) {
+		trace = doarr_trace_begin();
+		void *module = doarr_orc_load(output, "DOARR_EXPORT_0"); // every module has it
+		doarr_trace_end(trace, "orc_load", output);
+		if(so_fd >= 0)
+			close(so_fd);
+		else
+			try_remove(output);
+		if(!module)
+			return 2;
+		*out_handle = orc_handle(module);
+		return 0;
+	}
+#endif
+
+	void *handle = load(output);
+	if(so_fd >= 0) {
+		// on success, the memfd is closed by doarr_module_unload
+		if(!handle)
+			close(so_fd);
+	} else {
+		if(handle && dir) {
+			// each entry point gets its own name, all of them linked to the same file
+			for(size_t i = 0; i < num_publish; i++)
+				publish(dir, output, &publish_as[i], tmp_suffix);
+		}
+		try_remove(output);
+	}
+	if(!handle)
+		return 2;
 
 	*out_handle = handle;
-	*out_fn = fn;
 	return 0;
 }
+
+int doarr_notify_fd_create(void) {
+	return eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+}
+
+void doarr_notify_fd_signal(void *fd) {
+	uint64_t one = 1;
+	if(write((int) (intptr_t) fd, &one, sizeof one) < 0)
+		perror("Cannot signal completion: write");
+}
+
+void doarr_notify_fd_close(int fd) {
+	if(close(fd))
+		perror("close");
+}
+
+void doarr_cache_name(struct doarr_io_ctx *ctx, struct guest_file *file, const char *const *extra_args, size_t num_extra_args, const char *src, size_t src_size, struct cache_name *out_name) {
+	pthread_mutex_lock(&ctx->mutex);
+	struct doarr_digest d = *gch_digest_locked(file);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	for(int i = 0; i < file->num_compiler_args; i++)
+		doarr_digest_update(&d, file->compiler_args[i], strlen(file->compiler_args[i]));
+	doarr_digest_update(&d, &file->pos_between_args, sizeof file->pos_between_args);
+	if(uses_variant(ctx, file)) { // the precompiled header for ctx->march, the code may only run on CPUs like this one
+		doarr_digest_update(&d, ctx->march, strlen(ctx->march));
+		doarr_digest_update(&d, &file->source_digest, sizeof file->source_digest);
+	}
+	for(size_t i = 0; i < num_extra_args; i++)
+		doarr_digest_update(&d, extra_args[i], strlen(extra_args[i]));
+	doarr_digest_update(&d, &num_extra_args, sizeof num_extra_args);
+	doarr_digest_update(&d, src, src_size);
+
+	digest_name(&d, out_name);
+}
+
+int doarr_cache_load(struct doarr_io_ctx *ctx, const struct cache_name *name, void **out_handle, void **out_fn) {
+	if(!ctx->cache_dir)
+		return 1;
+
+	char path[strlen(ctx->cache_dir) + cache_name_len + 5]; // VLA!
+	sprintf(path, "%s/%s.so", ctx->cache_dir, name->chars);
+
+	// only published (i.e. complete) files can have this name
+	if(access(path, R_OK))
+		return 1;
+
+	// a file that cannot be loaded will be recompiled and replaced
+	unsigned long long trace = doarr_trace_begin();
+	void *handle = load(path);
+	if(!handle)
+		return 1;
+
+	// the file may have been compiled in a batch, find our entry point by name
+	const char *const *names = dlsym(handle, "DOARR_EXPORT_names");
+	if(names) {
+		for(size_t i = 0; names[i]; i++) {
+			if(!strcmp(names[i], name->chars) && !doarr_lookup_entry(handle, i, out_fn)) {
+				*out_handle = handle;
+				doarr_trace_end(trace, "disk_cache_load", path);
+				return 0;
+			}
+		}
+	}
+	dlclose(handle);
+	return 1;
+}
+
+
+static char cpu_model[256];
+static pthread_once_t cpu_model_once = PTHREAD_ONCE_INIT;
+
+// the model name of the first CPU in /proc/cpuinfo, or the machine from uname
+static void read_cpu_model(void) {
+	FILE *f = fopen("/proc/cpuinfo", "r");
+	if(f) {
+		char line[sizeof cpu_model + 32];
+		while(fgets(line, sizeof line, f)) {
+			char *colon = strchr(line, ':');
+			if(colon && !strncmp(line, "model name", 10)) {
+				snprintf(cpu_model, sizeof cpu_model, "%s", colon + 1);
+				break;
+			}
+		}
+		fclose(f);
+	}
+	struct utsname u;
+	if(!*cpu_model && !uname(&u))
+		snprintf(cpu_model, sizeof cpu_model, "%s", u.machine);
+}
+
+void doarr_tuning_name(struct doarr_digest *d, struct cache_name *out_name) {
+	pthread_once(&cpu_model_once, read_cpu_model);
+	doarr_digest_update(d, cpu_model, strlen(cpu_model));
+	digest_name(d, out_name);
+}
+
+int doarr_tuning_load(struct doarr_io_ctx *ctx, const struct cache_name *name, size_t *out_winner) {
+	if(!ctx->cache_dir)
+		return 1;
+
+	char path[strlen(ctx->cache_dir) + cache_name_len + 7]; // VLA!
+	sprintf(path, "%s/%s.tune", ctx->cache_dir, name->chars);
+	FILE *f = fopen(path, "r");
+	if(!f)
+		return 1;
+	int ok = fscanf(f, "%zu", out_winner) == 1;
+	fclose(f);
+	return !ok;
+}
+
+void doarr_tuning_store(struct doarr_io_ctx *ctx, const struct cache_name *name, size_t winner) {
+	if(!ctx->cache_dir)
+		return;
+
+	char path[strlen(ctx->cache_dir) + cache_name_len + 7]; // VLA!
+	char tmp_name[strlen(ctx->cache_dir) + cache_name_len + 3 * sizeof(long) + 7]; // VLA!
+	sprintf(path, "%s/%s.tune", ctx->cache_dir, name->chars);
+	sprintf(tmp_name, "%s/%s.%ld.tmp", ctx->cache_dir, name->chars, (long) getpid());
+	FILE *f = fopen(tmp_name, "w");
+	if(!f) {
+		perror("Cannot publish to persistent cache: fopen");
+		return;
+	}
+	int ok = fprintf(f, "%zu\n", winner) > 0;
+	if(fclose(f) || !ok) {
+		perror("Cannot publish to persistent cache: write");
+		try_remove(tmp_name);
+		return;
+	}
+	// atomically replaces whatever may have been published meanwhile
+	if(rename(tmp_name, path)) {
+		perror("Cannot publish to persistent cache: rename");
+		try_remove(tmp_name);
+	}
+}
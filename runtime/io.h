@@ -6,27 +6,73 @@
  */
 
 #include "common.h"
+#include "digest.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
 
 struct doarr_io_ctx {
+	pthread_mutex_t mutex; // guards tmp_path and the lazily initialized parts of guest files
+	pthread_cond_t gch_built; // signalled when a precompiled header built with the mutex unlocked is done
 	struct tmp_path tmp_path;
+	const char *cache_dir; // persistent cache (DOARR_CACHE_DIR), or NULL if disabled
+	const char *pch_dir; // precompiled headers shared by all processes of the user, or NULL if disabled (DOARR_SHARED_PCH=0)
+	int launcher_fd; // socket to the compiler launcher process, or -1 if disabled (DOARR_LAUNCHER=0)
+	int diskless; // sources and shared objects are kept in memfds (DOARR_DISKLESS=1), except when publishing to the persistent cache
+	const char *march; // -march for the specializations (see DOARR_MARCH), or NULL if disabled
+	int orc; // compile to relocatable objects linked by the ORC backend (built with ORC=1, DOARR_ORC=0 disables it), except when publishing
 };
 
 enum {
 	tmp_path_size = sizeof(struct tmp_path),
-	tmp_path_len = tmp_path_size - 1,
 	tmp_ext_len = 4,
 	tmp_ext_size = tmp_ext_len + 1,
-	tmp_full_path_len = tmp_path_len + tmp_ext_len,
-	tmp_full_path_size = tmp_full_path_len + 1,
+	tmp_full_path_size = tmp_path_size + tmp_ext_len,
 };
 
 struct tmp_full_path {
 	char chars[tmp_full_path_size];
 };
 
+// generated source of one compilation
+struct doarr_source {
+	struct tmp_full_path name; // as passed to the compiler
+	int fd; // the memfd behind the name, or -1 if it is a file in the scratch directory
+};
+
+enum {
+	cache_name_len = 2 * sizeof(struct doarr_digest),
+	cache_name_size = cache_name_len + 1,
+};
+
+struct cache_name {
+	char chars[cache_name_size];
+};
+
 INTERNAL_VISIBILITY int doarr_io_init(struct doarr_io_ctx *ctx);
-INTERNAL_VISIBILITY void doarr_tmp_path(struct doarr_io_ctx *ctx, const char ext[tmp_ext_size], struct tmp_full_path *out_path);
+INTERNAL_VISIBILITY FILE *doarr_source_create(struct doarr_io_ctx *ctx, struct doarr_source *out_src); // returns the stream to write the source to, or NULL
 INTERNAL_VISIBILITY const char *doarr_extract_precompiled_or_null(struct doarr_io_ctx *ctx, struct guest_file *file);
-INTERNAL_VISIBILITY int doarr_compile_and_load(struct doarr_io_ctx *ctx, struct tmp_full_path *cxx_file_name, const struct guest_file *file, void **out_handle, void **out_fn);
+// whether the sources generated for file can include the source of other (i.e. it is known and dcc got the same args for both)
+INTERNAL_VISIBILITY int doarr_can_include_source(const struct guest_file *file, const struct guest_file *other);
+// writes the inclusion of the source, guarded so that any number of entry points in one generated source can have it
+INTERNAL_VISIBILITY void doarr_write_source_include(struct doarr_io_ctx *ctx, struct guest_file *file, FILE *out);
+INTERNAL_VISIBILITY int doarr_compile_and_load(struct doarr_io_ctx *ctx, struct doarr_source *src, const struct guest_file *file, const char *const *extra_args, size_t num_extra_args, const struct cache_name *publish_as, size_t num_publish, void **out_handle);
+INTERNAL_VISIBILITY int doarr_lookup_entry(void *handle, size_t index, void **out_fn);
+INTERNAL_VISIBILITY void *doarr_lookup_symbol(void *handle, const char *symbol); // returns NULL if not found (not reported, unless linked by ORC)
+INTERNAL_VISIBILITY size_t doarr_module_size(void *handle); // bytes mapped by the loadable segments
+INTERNAL_VISIBILITY void doarr_module_unload(void *handle);
+
+INTERNAL_VISIBILITY int doarr_notify_fd_create(void);
+INTERNAL_VISIBILITY void doarr_notify_fd_signal(void *fd); // takes the fd cast to a pointer, to be usable as a callback
+INTERNAL_VISIBILITY void doarr_notify_fd_close(int fd);
+
+INTERNAL_VISIBILITY void doarr_cache_name(struct doarr_io_ctx *ctx, struct guest_file *file, const char *const *extra_args, size_t num_extra_args, const char *src, size_t src_size, struct cache_name *out_name);
+INTERNAL_VISIBILITY int doarr_cache_load(struct doarr_io_ctx *ctx, const struct cache_name *name, void **out_handle, void **out_fn);
+
+// results of doarr::autotune in the persistent cache, named by the digest of the candidates and the CPU model
+INTERNAL_VISIBILITY void doarr_tuning_name(struct doarr_digest *d, struct cache_name *out_name); // adds the CPU model to the digest
+INTERNAL_VISIBILITY int doarr_tuning_load(struct doarr_io_ctx *ctx, const struct cache_name *name, size_t *out_winner);
+INTERNAL_VISIBILITY void doarr_tuning_store(struct doarr_io_ctx *ctx, const struct cache_name *name, size_t winner);
 
 #endif
@@ -0,0 +1,181 @@
+extern "C" {
+#include "orc.h"
+}
+
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+namespace orc = llvm::orc;
+
+// an array of function pointers in the linked code
+struct fn_array {
+	std::uint64_t address;
+	std::size_t count;
+};
+
+struct orc_module {
+	orc::JITDylib *dylib;
+	std::size_t size = 0; // bytes of the loaded sections
+	std::vector<fn_array> init, fini; // .init_array and .fini_array sections, in the order of the object file
+};
+
+void report(const char *what, llvm::Error err) {
+	std::fprintf(stderr, "%s: %s\n", what, llvm::toString(std::move(err)).c_str());
+}
+
+// the modules being loaded, filled in by note_loaded
+std::mutex GLOBAL_loading_mutex;
+std::unordered_map<orc::JITDylib *, orc_module *> GLOBAL_loading;
+
+void note_loaded(orc::MaterializationResponsibility &r, const llvm::object::ObjectFile &obj, const llvm::RuntimeDyld::LoadedObjectInfo &info) {
+	std::lock_guard lock(GLOBAL_loading_mutex);
+	auto it = GLOBAL_loading.find(&r.getTargetJITDylib());
+	if(it == GLOBAL_loading.end())
+		return;
+	orc_module *m = it->second;
+	for(const auto &section : obj.sections()) {
+		std::uint64_t address = info.getSectionLoadAddress(section);
+		if(!address)
+			continue; // not loaded
+		m->size += section.getSize();
+		auto name = section.getName();
+		if(!name) {
+			llvm::consumeError(name.takeError());
+			continue;
+		}
+		if(*name == ".init_array" || name->startswith(".init_array."))
+			m->init.push_back({address, section.getSize() / sizeof(void (*)())});
+		else if(*name == ".fini_array" || name->startswith(".fini_array."))
+			m->fini.push_back({address, section.getSize() / sizeof(void (*)())});
+	}
+}
+
+void run_all(const std::vector<fn_array> &arrays, bool reverse) {
+	for(std::size_t i = 0; i < arrays.size(); i++) {
+		const fn_array &a = arrays[reverse ? arrays.size() - 1 - i : i];
+		auto *fns = llvm::jitTargetAddressToPointer<void (**)()>(a.address);
+		for(std::size_t j = 0; j < a.count; j++)
+			fns[reverse ? a.count - 1 - j : j]();
+	}
+}
+
+// created on first use and never destroyed (the compiled code may run until exit), NULL on error
+orc::LLJIT *GLOBAL_jit() {
+	static orc::LLJIT *const instance = [] () -> orc::LLJIT * {
+		llvm::InitializeNativeTarget();
+		llvm::InitializeNativeTargetAsmPrinter();
+		auto jit = orc::LLJITBuilder()
+			.setObjectLinkingLayerCreator([](orc::ExecutionSession &es, const llvm::Triple &) -> llvm::Expected<std::unique_ptr<orc::ObjectLayer>> {
+				auto layer = std::make_unique<orc::RTDyldObjectLinkingLayer>(es, [] { return std::make_unique<llvm::SectionMemoryManager>(); });
+				layer->setNotifyLoaded(note_loaded);
+				return layer;
+			})
+			.create();
+		if(!jit) {
+			report("Could not create the JIT", jit.takeError());
+			return nullptr;
+		}
+		return jit->release();
+	}();
+	return instance;
+}
+
+std::atomic<unsigned long> GLOBAL_num_dylibs;
+
+} // unnamed ns
+
+void *doarr_orc_load(const char *object_file_name, const char *link_symbol) {
+	orc::LLJIT *jit = GLOBAL_jit();
+	if(!jit)
+		return nullptr;
+
+	auto buffer = llvm::MemoryBuffer::getFile(object_file_name, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+	if(!buffer) {
+		std::fprintf(stderr, "Could not read %s: %s\n", object_file_name, buffer.getError().message().c_str());
+		return nullptr;
+	}
+
+	// the entry points of every module have the same names, so each needs its own dylib
+	auto dylib = jit->createJITDylib("doarr." + std::to_string(GLOBAL_num_dylibs.fetch_add(1, std::memory_order_relaxed)));
+	if(!dylib) {
+		report("Could not create a JIT dylib", dylib.takeError());
+		return nullptr;
+	}
+	auto generator = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(jit->getDataLayout().getGlobalPrefix());
+	if(!generator) {
+		report("Could not resolve symbols of the process", generator.takeError());
+		llvm::consumeError(jit->getExecutionSession().removeJITDylib(*dylib));
+		return nullptr;
+	}
+	dylib->addGenerator(std::move(*generator));
+	if(auto err = jit->addObjectFile(*dylib, std::move(*buffer))) {
+		report("Could not add the compiled code", std::move(err));
+		llvm::consumeError(jit->getExecutionSession().removeJITDylib(*dylib));
+		return nullptr;
+	}
+
+	// link it now, note_loaded records what it needs
+	auto *m = new orc_module{&*dylib, 0, {}, {}};
+	{
+		std::lock_guard lock(GLOBAL_loading_mutex);
+		GLOBAL_loading.emplace(m->dylib, m);
+	}
+	auto sym = jit->lookup(*dylib, link_symbol);
+	{
+		std::lock_guard lock(GLOBAL_loading_mutex);
+		GLOBAL_loading.erase(m->dylib);
+	}
+	if(!sym) {
+		report("Could not link the compiled code", sym.takeError());
+		llvm::consumeError(jit->getExecutionSession().removeJITDylib(*dylib));
+		delete m;
+		return nullptr;
+	}
+
+	// the platform's initializers, then the static initializers of the object (as run by dlopen, which the default platform does not do for objects)
+	if(auto err = jit->initialize(*dylib)) {
+		report("Could not initialize the compiled code", std::move(err));
+		llvm::consumeError(jit->getExecutionSession().removeJITDylib(*dylib));
+		delete m;
+		return nullptr;
+	}
+	run_all(m->init, false);
+	return m;
+}
+
+void *doarr_orc_lookup(void *module, const char *symbol) {
+	auto *m = static_cast<orc_module *>(module);
+	auto sym = GLOBAL_jit()->lookup(*m->dylib, symbol);
+	if(!sym) {
+		report("Could not link the compiled code", sym.takeError());
+		return nullptr;
+	}
+	return llvm::jitTargetAddressToPointer<void *>(sym->getAddress());
+}
+
+size_t doarr_orc_size(void *module) {
+	return static_cast<orc_module *>(module)->size;
+}
+
+void doarr_orc_unload(void *module) {
+	auto *m = static_cast<orc_module *>(module);
+	run_all(m->fini, true);
+	if(auto err = GLOBAL_jit()->getExecutionSession().removeJITDylib(*m->dylib))
+		report("Could not unload the compiled code", std::move(err));
+	delete m;
+}
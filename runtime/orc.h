@@ -0,0 +1,19 @@
+#ifndef ORC_H_
+#define ORC_H_
+
+/*
+ * Optional in-process linker backend (built with ORC=1), defined in orc.cpp and used by io.c.
+ * Relocatable objects from the compiler are linked into the process with LLVM ORC, instead of a shared library linked by ld and loaded by dlopen.
+ */
+
+#include <stddef.h>
+
+// Each object gets its own namespace. It is linked right away (by looking up link_symbol, which it must define)
+// and its static initializers are run, as by dlopen. Returns NULL on error (reported to stderr).
+INTERNAL_VISIBILITY void *doarr_orc_load(const char *object_file_name, const char *link_symbol);
+// returns NULL on error (reported to stderr)
+INTERNAL_VISIBILITY void *doarr_orc_lookup(void *module, const char *symbol);
+INTERNAL_VISIBILITY size_t doarr_orc_size(void *module); // bytes of the loaded sections
+INTERNAL_VISIBILITY void doarr_orc_unload(void *module);
+
+#endif
@@ -0,0 +1,197 @@
+#include <doarr/export.hpp>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using doarr::internal::parallel_chunk_fn;
+
+namespace {
+
+// the part of the range that starts with one thread, idle threads steal from it too
+struct alignas(64) slice {
+	std::atomic<std::size_t> next;
+	std::size_t end;
+};
+
+struct job {
+	parallel_chunk_fn *chunk;
+	void *body;
+	std::size_t grain;
+};
+
+// set in the workers and while the caller takes part in a loop, nested loops run serially
+thread_local bool GLOBAL_in_loop;
+
+// NUMA node of each CPU (from sysfs), -1 if unknown
+std::vector<int> cpu_nodes() {
+	std::vector<int> nodes;
+	DIR *dir = opendir("/sys/devices/system/node");
+	if(!dir)
+		return nodes;
+	while(const dirent *ent = readdir(dir)) {
+		int node, end = 0;
+		if(std::sscanf(ent->d_name, "node%d%n", &node, &end) != 1 || ent->d_name[end])
+			continue;
+		char path[64 + sizeof ent->d_name];
+		std::sprintf(path, "/sys/devices/system/node/%s/cpulist", ent->d_name);
+		std::FILE *f = std::fopen(path, "r");
+		if(!f)
+			continue;
+		// e.g. 0-3,8-11
+		unsigned first, last;
+		int n;
+		while((n = std::fscanf(f, "%u-%u", &first, &last)) >= 1) {
+			if(n == 1)
+				last = first;
+			if(nodes.size() <= last)
+				nodes.resize(last + 1, -1);
+			for(unsigned cpu = first; cpu <= last; cpu++)
+				nodes[cpu] = node;
+			if(std::fgetc(f) != ',')
+				break;
+		}
+		std::fclose(f);
+	}
+	closedir(dir);
+	return nodes;
+}
+
+// The allowed CPUs, ordered by NUMA node, so that neighbouring slices (which steal from each other first) share a node.
+std::vector<int> ordered_cpus() {
+	std::vector<int> cpus;
+	cpu_set_t set;
+	if(sched_getaffinity(0, sizeof set, &set))
+		return cpus;
+	for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if(CPU_ISSET(cpu, &set))
+			cpus.push_back(cpu);
+	auto nodes = cpu_nodes();
+	auto node = [&nodes](int cpu) { return (std::size_t) cpu < nodes.size() ? nodes[cpu] : -1; };
+	std::ranges::stable_sort(cpus, {}, node);
+	return cpus;
+}
+
+std::size_t env_size(const char *name, std::size_t default_value) {
+	const char *value = std::getenv(name);
+	return value && *value ? std::strtoull(value, nullptr, 10) : default_value;
+}
+
+void pin_to(int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(int err = pthread_setaffinity_np(pthread_self(), sizeof set, &set))
+		std::fprintf(stderr, "Cannot pin a worker thread: %s\n", std::strerror(err));
+}
+
+// Persistent worker threads, started on first use and never stopped. One loop runs at a time, the caller takes the first slice.
+// DOARR_THREADS sets the number of threads including the caller (the allowed CPUs by default, 1 disables the pool).
+// Unless DOARR_PIN_THREADS=0, the workers are pinned to the allowed CPUs in the order of their NUMA nodes (if there are enough of them).
+class pool {
+	std::mutex busy; // held while a loop runs
+	const job *current;
+	std::unique_ptr<slice[]> slices; // one per thread
+	std::atomic<std::uint64_t> generation = 0; // bumped to start a loop
+	std::atomic<std::size_t> running = 0; // workers that have not finished the current loop
+	std::size_t num_threads;
+
+	void run_slices(std::size_t own) const noexcept {
+		// own slice first, then the others in order (the nearest CPUs first)
+		for(std::size_t k = 0; k < num_threads; k++) {
+			slice &s = slices[(own + k) % num_threads];
+			while(s.next.load(std::memory_order_relaxed) < s.end) {
+				std::size_t begin = s.next.fetch_add(current->grain, std::memory_order_relaxed);
+				if(begin >= s.end)
+					break;
+				current->chunk(current->body, begin, std::min(begin + current->grain, s.end));
+			}
+		}
+	}
+
+	void work(std::size_t index) noexcept {
+		GLOBAL_in_loop = true;
+		std::uint64_t seen = 0;
+		for(;;) {
+			// spin for a while first, loops often come right after each other
+			for(int i = 0; i < 4096 && generation.load(std::memory_order_acquire) == seen; i++)
+				std::this_thread::yield();
+			generation.wait(seen, std::memory_order_acquire);
+			seen = generation.load(std::memory_order_acquire);
+			run_slices(index);
+			if(running.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				running.notify_one();
+		}
+	}
+
+public:
+	pool() {
+		auto cpus = ordered_cpus();
+		num_threads = std::max(env_size("DOARR_THREADS", cpus.size()), std::size_t{1});
+		bool pin = num_threads <= cpus.size() && env_size("DOARR_PIN_THREADS", 1);
+		slices.reset(new slice[num_threads]);
+		for(std::size_t i = 1; i < num_threads; i++) {
+			std::thread([this, i, cpu = pin ? cpus[i] : -1] {
+				if(cpu >= 0)
+					pin_to(cpu);
+				work(i);
+			}).detach();
+		}
+	}
+
+	void run(std::size_t begin, std::size_t end, parallel_chunk_fn *chunk, void *body) {
+		if(begin >= end)
+			return;
+		std::size_t size = end - begin;
+		std::size_t grain = std::max(size / (num_threads * 16), std::size_t{1});
+		if(num_threads == 1 || size <= grain || GLOBAL_in_loop || !busy.try_lock()) {
+			chunk(body, begin, end);
+			return;
+		}
+		std::lock_guard lock(busy, std::adopt_lock);
+
+		// contiguous slices of whole chunks
+		std::size_t per_thread = ((size + grain - 1) / grain + num_threads - 1) / num_threads * grain;
+		for(std::size_t i = 0; i < num_threads; i++) {
+			std::size_t first = std::min(begin + i * per_thread, end);
+			slices[i].next.store(first, std::memory_order_relaxed);
+			slices[i].end = std::min(first + per_thread, end);
+		}
+		job j{chunk, body, grain};
+		current = &j;
+		running.store(num_threads - 1, std::memory_order_relaxed);
+		generation.fetch_add(1, std::memory_order_release);
+		generation.notify_all();
+
+		GLOBAL_in_loop = true;
+		run_slices(0);
+		GLOBAL_in_loop = false;
+		for(std::size_t r; (r = running.load(std::memory_order_acquire));)
+			running.wait(r, std::memory_order_acquire);
+	}
+};
+
+pool &GLOBAL_pool() {
+	static pool *instance = new pool; // leaked, the workers never stop
+	return *instance;
+}
+
+void run_parallel(std::size_t begin, std::size_t end, parallel_chunk_fn *chunk, void *body) {
+	GLOBAL_pool().run(begin, end, chunk, body);
+}
+
+} // unnamed ns
+
+doarr::internal::parallel_run_fn *doarr_parallel_run = run_parallel;
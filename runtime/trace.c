@@ -0,0 +1,137 @@
+#define _GNU_SOURCE // gettid
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+enum {
+	max_events = 1 << 14, // later events are dropped
+	detail_size = 2048, // longer details are cut after their last line that fits (see set_detail)
+};
+
+struct trace_event {
+	atomic_bool complete; // set once the rest is written
+	const char *name;
+	unsigned long long begin, end;
+	pid_t tid;
+	char *detail; // allocated when recorded (so that the table stays small), NULL if none
+};
+
+// The events are only appended, each thread reserves its slot with a single atomic increment and fills it without locking.
+static struct trace_event *events; // NULL if disabled
+static atomic_size_t num_events;
+static const char *trace_path;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+static unsigned long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void doarr_json_escaped(FILE *out, const char *s) {
+	for(; *s; s++) {
+		unsigned char c = *s;
+		if(c == '\n')
+			fputs("\\n", out);
+		else if(c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else if(c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else
+			fputc(c, out);
+	}
+}
+
+static void set_detail(struct trace_event *e, const char *detail) {
+	static const char marker[] = "...\n";
+	size_t len = strlen(detail);
+	e->detail = malloc(len < detail_size ? len + 1 : detail_size);
+	if(!e->detail)
+		return; // recorded without it
+	if(len < detail_size) {
+		memcpy(e->detail, detail, len + 1);
+		return;
+	}
+	// keep whole lines (e.g. the specializations of a batch, one per line) and mark the cut
+	size_t keep = detail_size - sizeof marker;
+	while(keep && detail[keep - 1] != '\n')
+		keep--;
+	if(!keep)
+		keep = detail_size - sizeof marker; // a single long line
+	memcpy(e->detail, detail, keep);
+	memcpy(e->detail + keep, marker, sizeof marker);
+}
+
+static void write_trace(void) {
+	FILE *out = fopen(trace_path, "w");
+	if(!out) {
+		perror(trace_path);
+		return;
+	}
+	size_t n = atomic_load(&num_events);
+	if(n > max_events) {
+		fprintf(stderr, "doarr trace: %zu events dropped\n", n - max_events);
+		n = max_events;
+	}
+	long pid = getpid();
+	fputs("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [", out);
+	bool sep = false;
+	for(size_t i = 0; i < n; i++) {
+		const struct trace_event *e = &events[i];
+		if(!atomic_load_explicit(&e->complete, memory_order_acquire))
+			continue; // still being recorded
+		fprintf(out, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %ld, \"tid\": %ld, \"ts\": %.3f, \"dur\": %.3f", sep ? "," : "",
+			e->name, pid, (long) e->tid, e->begin / 1e3, (e->end - e->begin) / 1e3);
+		if(e->detail && *e->detail) {
+			fputs(", \"args\": {\"detail\": \"", out);
+			doarr_json_escaped(out, e->detail);
+			fputs("\"}", out);
+		}
+		fputc('}', out);
+		sep = true;
+	}
+	fputs("\n]}\n", out);
+	fclose(out);
+}
+
+static void init_trace(void) {
+	trace_path = getenv("DOARR_TRACE");
+	if(!trace_path || !*trace_path)
+		return;
+	events = calloc(max_events, sizeof *events);
+	if(!events) {
+		perror("doarr trace: calloc");
+		return;
+	}
+	atexit(write_trace);
+}
+
+unsigned long long doarr_trace_begin(void) {
+	pthread_once(&trace_once, init_trace);
+	return events ? now_ns() : 0;
+}
+
+void doarr_trace_end(unsigned long long begin, const char *name, const char *detail) {
+	if(!begin)
+		return;
+	unsigned long long end = now_ns();
+	size_t i = atomic_fetch_add_explicit(&num_events, 1, memory_order_relaxed);
+	if(i >= max_events)
+		return;
+	struct trace_event *e = &events[i];
+	e->name = name;
+	e->begin = begin;
+	e->end = end;
+	e->tid = gettid();
+	if(detail)
+		set_detail(e, detail);
+	atomic_store_explicit(&e->complete, true, memory_order_release);
+}
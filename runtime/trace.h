@@ -0,0 +1,20 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+/*
+ * Opt-in tracer of the compilation pipeline, defined in trace.c.
+ * With DOARR_TRACE=<path>, the recorded phases are written there at exit as Chrome trace-event JSON (for Perfetto or chrome://tracing).
+ */
+
+#include <stdio.h>
+
+// returns the time at which a phase begins, or 0 if tracing is disabled
+INTERNAL_VISIBILITY unsigned long long doarr_trace_begin(void);
+
+// records a phase from begin (ignored if 0) to now, name must be a string literal, detail (may be NULL) is copied (possibly truncated)
+INTERNAL_VISIBILITY void doarr_trace_end(unsigned long long begin, const char *name, const char *detail);
+
+// writes the string escaped for a JSON string literal (also used for the statistics, see doarr::write_stats_json)
+INTERNAL_VISIBILITY void doarr_json_escaped(FILE *out, const char *s);
+
+#endif
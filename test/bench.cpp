@@ -0,0 +1,264 @@
+#include <doarr/import.hpp>
+#include <doarr/expr.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <latch>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+////////////////////////////////////////////////////////////////
+
+extern "C" doarr::imported add;
+extern "C" doarr::imported addt;
+extern "C" doarr::imported nempty;
+
+using doarr::noarr;
+
+using clk = std::chrono::steady_clock;
+
+double ns_since(clk::time_point begin) {
+	return std::chrono::duration<double, std::nano>(clk::now() - begin).count();
+}
+
+struct result {
+	std::string name;
+	long iters; // per repetition
+	double p50, p90, p99, min; // ns per iteration, over repetitions
+};
+
+std::vector<result> GLOBAL_results;
+
+// Runs body(iters) a few times to warm up, then once per repetition, and records the time per iteration.
+void measure(std::string name, long iters, auto body, int reps = 31, int warmup = 3) {
+	for(int i = 0; i < warmup; i++)
+		body(iters);
+	std::vector<double> samples;
+	for(int i = 0; i < reps; i++) {
+		auto begin = clk::now();
+		body(iters);
+		samples.push_back(ns_since(begin) / iters);
+	}
+	std::sort(samples.begin(), samples.end());
+	auto pct = [&samples](int p) { return samples[(samples.size() - 1) * p / 100]; };
+	auto &r = GLOBAL_results.emplace_back(result{std::move(name), iters, pct(50), pct(90), pct(99), samples.front()});
+	std::printf("%-44s | %12.1f | %12.1f | %12.1f\n", r.name.c_str(), r.p50, r.p90, r.p99);
+}
+
+void write_json(const char *path) {
+	std::FILE *out = std::fopen(path, "w");
+	if(!out) {
+		std::perror(path);
+		return;
+	}
+	std::fputs("{\"benchmarks\": [", out);
+	bool sep = false;
+	for(const auto &r : GLOBAL_results) {
+		std::fprintf(out, "%s\n\t{\"name\": \"%s\", \"iters\": %ld, \"p50_ns\": %.3f, \"p90_ns\": %.3f, \"p99_ns\": %.3f, \"min_ns\": %.3f}",
+			sep ? "," : "", r.name.c_str(), r.iters, r.p50, r.p90, r.p99, r.min);
+		sep = true;
+	}
+	std::fputs("\n]}\n", out);
+	std::fclose(out);
+}
+
+std::atomic<std::size_t> GLOBAL_sink; // keeps results from being optimized out
+
+////////////////////////////////////////////////////////////////
+
+auto make_scalar() {
+	return noarr.scalar["float"]();
+}
+
+auto make_vector() {
+	return noarr.scalar["float"]() ^ noarr.vector['x']();
+}
+
+auto make_matrix() {
+	return noarr.scalar["float"]() ^ noarr.vector['x']() ^ noarr.vector['y']();
+}
+
+auto make_sized_matrix(std::size_t n) {
+	return noarr.scalar["float"]() ^ noarr.sized_vector['x'](doarr::dyn(n)) ^ noarr.sized_vector['y'](doarr::dyn(n));
+}
+
+void bench_exprs() {
+	measure("expr: scalar", 100000, [](long iters) {
+		for(long i = 0; i < iters; i++)
+			make_scalar();
+	});
+	measure("expr: vector", 100000, [](long iters) {
+		for(long i = 0; i < iters; i++)
+			make_vector();
+	});
+	measure("expr: matrix", 100000, [](long iters) {
+		for(long i = 0; i < iters; i++)
+			make_matrix();
+	});
+	measure("expr: sized matrix (dynamic sizes)", 100000, [](long iters) {
+		for(long i = 0; i < iters; i++)
+			make_sized_matrix(i);
+	});
+
+	doarr::exprs a{make_sized_matrix(1), doarr::ptr(nullptr)};
+	doarr::exprs b{make_sized_matrix(2), doarr::ptr(nullptr)};
+	measure("exprs: hash", 1000000, [&a](long iters) {
+		std::size_t h = 0;
+		for(long i = 0; i < iters; i++)
+			h += hash(a);
+		GLOBAL_sink += h;
+	});
+	measure("exprs: == (equal, distinct trees)", 1000000, [&a, &b](long iters) {
+		std::size_t n = 0;
+		for(long i = 0; i < iters; i++)
+			n += a == b;
+		GLOBAL_sink += n;
+	});
+}
+
+////////////////////////////////////////////////////////////////
+
+[[gnu::noinline]] void add_direct(int a, int b, void *c) {
+	*(int *) c = a + b;
+}
+
+void bench_calls() {
+	int c;
+	measure("call: direct C++ (baseline)", 1000000, [&c](long iters) {
+		for(long i = 0; i < iters; i++)
+			add_direct(1, i, &c);
+	});
+	add.prepare(doarr::num(1), doarr::dyn(0), doarr::ptr(&c));
+	measure("call: cache hit", 200000, [&c](long iters) {
+		for(long i = 0; i < iters; i++)
+			add(doarr::num(1), doarr::dyn(i), doarr::ptr(&c));
+	});
+	auto bound = add.bind(doarr::num(1), doarr::dyn_slot<int>(), doarr::ptr_slot());
+	measure("call: bound handle", 1000000, [&c, &bound](long iters) {
+		for(long i = 0; i < iters; i++)
+			bound(i, &c);
+	});
+	nempty.prepare(make_sized_matrix(0));
+	measure("call: cache hit, sized matrix", 100000, [](long iters) {
+		for(long i = 0; i < iters; i++)
+			nempty(make_sized_matrix(i));
+	});
+}
+
+// each iteration compiles a new shape (run with DOARR_TRACE to see the time of each phase)
+void bench_cold() {
+	int shape = 100000;
+	measure("cold: compile one specialization", 1, [&shape](long iters) {
+		int c;
+		for(long i = 0; i < iters; i++)
+			add.prepare(doarr::num(shape++), doarr::dyn(0), doarr::ptr(&c));
+	}, 5, 1);
+	measure("cold: prepare_all of 8 (per specialization)", 8, [&shape](long iters) {
+		std::vector<doarr::request> requests;
+		for(long i = 0; i < iters; i++)
+			requests.push_back(add.request(doarr::num(shape++), doarr::dyn(0), doarr::ptr(nullptr)));
+		doarr::prepare_all(std::move(requests));
+	}, 5, 1);
+}
+
+////////////////////////////////////////////////////////////////
+
+// Starts all threads at once and returns the wall time until the last one finishes.
+double run_threads(int num_threads, auto body) {
+	std::latch start(num_threads + 1);
+	std::vector<std::thread> threads;
+	for(int t = 0; t < num_threads; t++) {
+		threads.emplace_back([t, &start, &body] {
+			start.arrive_and_wait();
+			body(t);
+		});
+	}
+	start.arrive_and_wait();
+	auto begin = clk::now();
+	for(auto &thread : threads)
+		thread.join();
+	return ns_since(begin);
+}
+
+// cache hits on a shape that all threads share
+double bench_hits(int num_threads, long iters) {
+	int c;
+	add.prepare(doarr::num(1), doarr::dyn(2), doarr::ptr(&c)); // warm up (without leaving a compilation in the background)
+	return run_threads(num_threads, [iters](int t) {
+		int c;
+		for(long i = 0; i < iters; i++)
+			add(doarr::num(1), doarr::dyn(t), doarr::ptr(&c));
+	}) / iters;
+}
+
+// the same calls through a handle from imported::bind
+double bench_bound(int num_threads, long iters) {
+	auto bound = add.bind(doarr::num(1), doarr::dyn_slot<int>(), doarr::ptr_slot());
+	return run_threads(num_threads, [iters, &bound](int t) {
+		int c;
+		for(long i = 0; i < iters; i++)
+			bound(t, &c);
+	}) / iters;
+}
+
+// all threads miss on the same new shape at once, only one of them should compile it
+// (a template, as add has a generic fallback that would run instead of waiting)
+double bench_single_flight(int num_threads, int shape) {
+	return run_threads(num_threads, [shape](int t) {
+		int c;
+		addt[doarr::num(shape)](doarr::dyn(t), doarr::ptr(&c));
+	});
+}
+
+////////////////////////////////////////////////////////////////
+
+} // unnamed ns
+
+// usage: bench [results.json]
+int main(int argc, char **argv) {
+	doarr::init();
+	std::puts("");
+	std::printf("%-44s | %12s | %12s | %12s\n", "ns per iteration", "p50", "p90", "p99");
+	bench_exprs();
+	bench_calls();
+	bench_cold();
+	if(argc > 1)
+		write_json(argv[1]);
+
+	int max_threads = std::thread::hardware_concurrency();
+	if(max_threads < 1)
+		max_threads = 1;
+
+	std::puts("");
+	std::puts("cache hit, shared shape");
+	std::printf("%8s | %12s | %14s | %8s\n", "threads", "ns/call", "Mcalls/s total", "speedup");
+	double base = 0;
+	for(int n = 1; n <= max_threads; n *= 2) {
+		double ns = bench_hits(n, 200000);
+		double total = n * 1e3 / ns;
+		if(n == 1)
+			base = total;
+		std::printf("%8d | %12.1f | %14.2f | %8.2f\n", n, ns, total, total / base);
+	}
+
+	std::puts("");
+	std::puts("bound handle, shared shape");
+	std::printf("%8s | %12s | %14s\n", "threads", "ns/call", "Mcalls/s total");
+	for(int n = 1; n <= max_threads; n *= 2) {
+		double ns = bench_bound(n, 2000000);
+		std::printf("%8d | %12.1f | %14.2f\n", n, ns, n * 1e3 / ns);
+	}
+
+	std::puts("");
+	std::puts("concurrent misses on one new shape (single-flight compilation)");
+	std::printf("%8s | %12s\n", "threads", "ms total");
+	int shape = 1000;
+	for(int n = 1; n <= max_threads; n *= 2)
+		std::printf("%8d | %12.1f\n", n, bench_single_flight(n, shape++) / 1e6);
+	std::puts("");
+}
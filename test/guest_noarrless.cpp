@@ -11,3 +11,15 @@ template<int A>
 doarr::exported addt(int b, void *c) {
 	*(int *) c = A + b;
 }
+
+doarr::exported iota(void *a, std::size_t n) {
+	doarr::parallel_for(0, n, [a](std::size_t i) {
+		((std::size_t *) a)[i] = i;
+	});
+}
+
+static const int initialized = [] { volatile int v = 42; return v; }(); // a dynamic initializer
+
+doarr::exported read_initialized(void *out) {
+	*(int *) out = initialized;
+}
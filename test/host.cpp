@@ -1,11 +1,35 @@
 #include <doarr/import.hpp>
 #include <doarr/expr.hpp>
 
+#include <atomic>
+#include <coroutine>
 #include <exception>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+// counts the allocations of each thread, see test_add_no_alloc
+static thread_local std::size_t GLOBAL_num_allocs = 0;
+
+void *operator new(std::size_t size) {
+	GLOBAL_num_allocs++;
+	if(void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+	std::free(p);
+}
 
 namespace {
 
@@ -96,6 +120,252 @@ void test_add_ds(int a, int b) {
 	ASSERT_EQ(c, a + b);
 }
 
+void test_add_fallback(int a, int b) {
+	ASSERT(add.has_fallback());
+	int c = 999999999;
+	add(doarr::num(a), doarr::dyn(b), doarr::ptr(&c)); // runs the fallback, the specialization compiles in the background
+	ASSERT_EQ(c, a + b);
+	add.prepare(doarr::num(a), doarr::dyn(b), doarr::ptr(&c)); // waits for it
+	add(doarr::num(a), doarr::dyn(b + 1), doarr::ptr(&c));
+	ASSERT_EQ(c, a + b + 1);
+}
+
+void test_add_bind(int a, int b) {
+	int c = 999999999, d = 999999999;
+	auto direct = add.bind(doarr::num(a), doarr::dyn_slot<int>(), doarr::ptr_slot()); // the slots are all the params
+	direct(b, &c);
+	ASSERT_EQ(c, a + b);
+	direct(b + 1, &d);
+	ASSERT_EQ(d, a + b + 1);
+	auto indirect = add.bind(doarr::dyn(a), doarr::num(b), doarr::ptr_slot()); // the dyn value is kept in the handle
+	indirect(&c);
+	ASSERT_EQ(c, a + b);
+}
+
+void test_add_no_alloc(int a, int b) {
+	int c = 999999999;
+	add.prepare(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+	add(doarr::num(a), doarr::dyn(b), doarr::ptr(&c)); // fills the free lists of expression nodes
+	std::size_t before = GLOBAL_num_allocs;
+	for(int i = 0; i < 100; i++)
+		add(doarr::num(a), doarr::dyn(b + i), doarr::ptr(&c));
+	ASSERT_EQ(GLOBAL_num_allocs - before, std::size_t{0});
+	ASSERT_EQ(c, a + b + 99);
+}
+
+// equal trees are equal whether they are interned or not (the Makefile also runs the tests with a small table, which this fills up)
+void test_intern() {
+	auto tree = [](std::size_t i) {
+		return doarr::call_expr(doarr::qname_expr("f"), doarr::exprs(doarr::int_expr(i), doarr::call_expr(doarr::qname_expr("g"), doarr::exprs(doarr::int_expr(i)))));
+	};
+	doarr::expr before = tree(1);
+	std::vector<doarr::expr> filler;
+	for(std::size_t i = 2; i < 1000; i++)
+		filler.push_back(tree(i));
+	doarr::expr after = tree(1), other = tree(1000), other_again = tree(1000);
+	ASSERT(before == after);
+	ASSERT(after == before);
+	ASSERT(other == other_again);
+	ASSERT(!(before == other));
+}
+
+void test_stats(int a, int b) {
+	int c = 999999999;
+	doarr::set_stats_enabled(true);
+	add.prepare(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+	add(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+	add(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+	doarr::set_stats_enabled(false);
+	add(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+
+	std::string function = "add(" + std::to_string(a) + ", DOARR_EXPORT[0].i, DOARR_EXPORT[1].p)";
+	int found = 0;
+	for(const auto &s : doarr::stats().specializations) {
+		if(s.function != function)
+			continue;
+		found++;
+		ASSERT(s.state == std::string("ready"));
+		ASSERT(s.module_bytes > 0);
+		ASSERT_EQ(s.hits, 2u);
+		ASSERT_EQ(s.misses, 0u);
+		std::uint64_t total = 0;
+		for(auto n : s.overhead_ns_hist)
+			total += n;
+		ASSERT_EQ(total, 2u);
+	}
+	ASSERT_EQ(found, 1);
+
+	std::FILE *out = std::tmpfile();
+	doarr::write_stats_json(out);
+	ASSERT(std::ftell(out) > 0);
+	std::fclose(out);
+}
+
+
+void test_compiler_options(int a, int b) {
+	int c = 999999999;
+	{
+		doarr::compiler_options_scope scope("-O1");
+		add.prepare(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+		add(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+		ASSERT_EQ(c, a + b);
+	}
+	add.prepare(doarr::num(a), doarr::dyn(b + 1), doarr::ptr(&c));
+	add(doarr::num(a), doarr::dyn(b + 1), doarr::ptr(&c));
+	ASSERT_EQ(c, a + b + 1);
+	add.set_compiler_options("-O0 -Wno-invalid-pch"); // not accepted by the precompiled header (which is expected here, so not reported)
+	add.prepare(doarr::num(a), doarr::dyn(b + 2), doarr::ptr(&c));
+	add(doarr::num(a), doarr::dyn(b + 2), doarr::ptr(&c));
+	ASSERT_EQ(c, a + b + 2);
+	add.set_compiler_options("");
+
+	std::string function = "add(" + std::to_string(a) + ", DOARR_EXPORT[0].i, DOARR_EXPORT[1].p)";
+	int found = 0;
+	for(const auto &s : doarr::stats().specializations) {
+		if(s.function != function && s.function != function + " [-O1]" && s.function != function + " [-O0 -Wno-invalid-pch]")
+			continue;
+		found++;
+		ASSERT(s.state == std::string("ready"));
+	}
+	ASSERT_EQ(found, 3);
+}
+
+void test_value_profiling(int a, int b) {
+	int c = 999999999;
+	doarr::set_value_profiling(10);
+	doarr::set_stats_enabled(true);
+	add.prepare(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+	// a window with the value changing yields no variant, the next one with it stable does
+	for(int i = 0; i < 10; i++)
+		add(doarr::num(a), doarr::dyn(b + i), doarr::ptr(&c));
+	for(int i = 0; i < 10; i++)
+		add(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+
+	// the variant is compiled in the background
+	std::string variant = "add(" + std::to_string(a) + ", std::size_t{" + std::to_string(b) + "}, DOARR_EXPORT[0].p)";
+	auto find_variant = [&variant] {
+		for(auto &s : doarr::stats().specializations)
+			if(s.function == variant)
+				return s;
+		return doarr::specialization_stats{};
+	};
+	for(int i = 0; i < 10000 && find_variant().state != std::string("ready"); i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	ASSERT(find_variant().state == std::string("ready"));
+
+	c = 999999999;
+	add(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+	ASSERT_EQ(c, a + b);
+	add(doarr::num(a), doarr::dyn(b + 1), doarr::ptr(&c));
+	ASSERT_EQ(c, a + b + 1);
+	ASSERT_EQ(find_variant().hits, 1u);
+	doarr::set_stats_enabled(false);
+	doarr::set_value_profiling(0);
+}
+
+extern "C" doarr::imported read_initialized;
+
+// the static initializers of the compiled code must run, whichever backend loads it
+void test_static_init() {
+	int v = 0;
+	read_initialized.prepare(doarr::ptr(&v));
+	read_initialized(doarr::ptr(&v));
+	ASSERT_EQ(v, 42);
+}
+
+extern "C" doarr::imported iota;
+
+void test_parallel_for(std::size_t n) {
+	std::vector<std::size_t> a(n, 999999999);
+	iota(doarr::ptr(a.data()), doarr::num(n));
+	for(std::size_t i = 0; i < n; i++)
+		ASSERT_EQ(a[i], i);
+	std::vector<std::size_t> b(n + 1, 999999999);
+	iota(doarr::ptr(b.data()), doarr::dyn(n));
+	ASSERT_EQ(b[n - 1], n - 1);
+	ASSERT_EQ(b[n], 999999999u);
+}
+
+void test_autotune(int a, int b) {
+	int c = 999999999;
+	auto candidates = [a, b, &c] {
+		std::vector<doarr::request> v;
+		for(int i = 0; i < 4; i++)
+			v.push_back(add.request(doarr::num(a + i), doarr::dyn(b), doarr::ptr(&c)));
+		return v;
+	};
+	std::size_t winner = doarr::autotune(candidates());
+	ASSERT(winner < 4);
+	c = 999999999;
+	ASSERT_EQ(doarr::autotune(candidates()), winner);
+	ASSERT_EQ(c, 999999999); // remembered, not run again
+	add(doarr::num(a + (int) winner), doarr::dyn(b), doarr::ptr(&c));
+	ASSERT_EQ(c, a + b + (int) winner);
+}
+
+void test_add_threads(int num_threads) {
+	std::atomic<int> num_wrong = 0;
+	std::vector<std::thread> threads;
+	for(int t = 0; t < num_threads; t++) {
+		threads.emplace_back([t, &num_wrong] {
+			for(int i = 0; i < 100; i++) {
+				int a = 7000 + i % 4; // few shapes, all threads miss on them at about the same time
+				int c = 999999999;
+				add(doarr::num(a), doarr::dyn(t), doarr::ptr(&c));
+				if(c != a + t)
+					num_wrong++;
+			}
+		});
+	}
+	for(auto &thread : threads)
+		thread.join();
+	ASSERT_EQ(num_wrong.load(), 0);
+}
+
+void test_add_async(int a, int b) {
+	int c = 999999999;
+	auto future = add.compile_async(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+	ASSERT_EQ(c, 999999999);
+	auto spec = std::move(future).get();
+	spec();
+	ASSERT_EQ(c, a + b);
+}
+
+void test_add_async_fd(int a, int b) {
+	int c = 999999999;
+	auto future = add.compile_async(doarr::num(a), doarr::dyn(b), doarr::ptr(&c));
+	pollfd pfd = {.fd = future.notify_fd(), .events = POLLIN, .revents = 0};
+	ASSERT_EQ(poll(&pfd, 1, -1), 1);
+	ASSERT(future.ready());
+	std::move(future).get()();
+	ASSERT_EQ(c, a + b);
+}
+
+struct eager_task {
+	struct promise_type {
+		eager_task get_return_object() { return {}; }
+		std::suspend_never initial_suspend() { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+eager_task add_coroutine(int a, int b, int *c, std::atomic<bool> *done) {
+	auto spec = co_await add.compile_async(doarr::num(a), doarr::dyn(b), doarr::ptr(c));
+	spec();
+	*done = true;
+	done->notify_all();
+}
+
+void test_add_async_coroutine(int a, int b) {
+	int c = 999999999;
+	std::atomic<bool> done = false;
+	add_coroutine(a, b, &c, &done);
+	done.wait(false);
+	ASSERT_EQ(c, a + b);
+}
+
 
 extern "C" doarr::imported addt;
 
@@ -105,6 +375,44 @@ void test_add_tmpl(int a, int b) {
 	ASSERT_EQ(c, a + b);
 }
 
+void test_add_tmpl_bind(int a, int b) {
+	int c = 999999999;
+	auto bound = addt[doarr::num(a)].bind(doarr::dyn_slot<int>(), doarr::ptr(&c));
+	bound(b);
+	ASSERT_EQ(c, a + b);
+}
+
+void test_prepare_tmpl(int first, int count) {
+	std::vector<doarr::request> requests;
+	for(int a = first; a < first + count; a++)
+		requests.push_back(addt[doarr::num(a)].request(doarr::dyn(0), doarr::ptr(nullptr)));
+	doarr::prepare_all(std::move(requests));
+	for(int a = first; a < first + count; a++) {
+		int c = 999999999;
+		auto future = addt[doarr::num(a)].compile_async(doarr::dyn(1), doarr::ptr(&c));
+		ASSERT(future.ready());
+		std::move(future).get()();
+		ASSERT_EQ(c, a + 1);
+	}
+}
+
+void test_cache_budget(int first, int count) {
+	int c = 999999999;
+	auto pinned = add.compile_async(doarr::num(first - 1), doarr::dyn(1), doarr::ptr(&c)).get();
+	doarr::set_cache_budget(2, 0);
+	auto before = doarr::get_cache_stats();
+	for(int a = first; a < first + count; a++)
+		add.prepare(doarr::num(a), doarr::dyn(0), doarr::ptr(nullptr));
+	auto after = doarr::get_cache_stats();
+	ASSERT(after.modules <= 2 + 1); // the pinned one cannot be evicted
+	ASSERT(after.evictions >= before.evictions + count - 2);
+	pinned();
+	ASSERT_EQ(c, first);
+	add.prepare(doarr::num(first), doarr::dyn(0), doarr::ptr(nullptr));
+	ASSERT(doarr::get_cache_stats().reloads > after.reloads);
+	doarr::set_cache_budget(0, 0);
+}
+
 
 using doarr::noarr;
 
@@ -131,11 +439,39 @@ void test_noarr_szvector() {
 	nempty(noarr.scalar["float"]() ^ noarr.sized_vector['x'](42));
 }
 
+void test_noarr_prepare() {
+	nempty.prepare(noarr.scalar["double"]() ^ noarr.vector['x']());
+	doarr::prepare_all(
+		nempty.request(noarr.scalar["double"]() ^ noarr.vector['y']()),
+		nempty.request(noarr.scalar["double"]() ^ noarr.sized_vector['y'](doarr::dyn(0))),
+		add.request(doarr::num(1), doarr::num(1), doarr::ptr(nullptr))
+	);
+	ASSERT(nempty.compile_async(noarr.scalar["double"]() ^ noarr.vector['y']()).ready());
+}
+
+void test_fuse(int a, int b) {
+	int c = 999999999, d = 999999999;
+	doarr::set_stats_enabled(true);
+	doarr::fuse(
+		add.request(doarr::num(a), doarr::dyn(b), doarr::ptr(&c)),
+		nempty.request(noarr.scalar["float"]() ^ noarr.sized_vector['x'](doarr::dyn(b))),
+		add.request(doarr::num(1), doarr::dyn(2), doarr::ptr(&d))
+	);
+	ASSERT_EQ(c, a + b);
+	ASSERT_EQ(d, 3);
+	bool found = false;
+	for(const auto &s : doarr::stats().specializations)
+		found |= s.function.starts_with("fuse{");
+	ASSERT(found);
+	doarr::set_stats_enabled(false);
+}
+
 ////////////////////////////////////////////////////////////////
 
 } // unnamed ns
 
 int main() {
+	doarr::init();
 	std::puts("");
 	RUN_TEST(test_empty());
 	RUN_TEST(test_empty());
@@ -148,8 +484,30 @@ int main() {
 	std::puts("");
 	RUN_TEST(test_add_sd(100, 200));
 	RUN_TEST(test_add_ds(300, 400));
+	RUN_TEST(test_add_fallback(600, 700));
+	RUN_TEST(test_add_bind(800, 900));
+	RUN_TEST(test_add_no_alloc(1000, 1100));
+	RUN_TEST(test_intern());
+	RUN_TEST(test_stats(1200, 1300));
+	RUN_TEST(test_compiler_options(1400, 1500));
+	RUN_TEST(test_value_profiling(1600, 1700));
+	RUN_TEST(test_autotune(2000, 2100));
+	std::puts("");
+	RUN_TEST(test_add_threads(8));
+	RUN_TEST(test_add_threads(8));
+	RUN_TEST(test_parallel_for(100000));
+	RUN_TEST(test_static_init());
+	std::puts("");
+	RUN_TEST(test_add_async(500, 600));
+	RUN_TEST(test_add_async(500, 700));
+	RUN_TEST(test_add_async_fd(501, 600));
+	RUN_TEST(test_add_async_coroutine(502, 600));
 	std::puts("");
 	RUN_TEST(test_add_tmpl(1111, 2222));
+	RUN_TEST(test_add_tmpl_bind(3333, 4444));
+	RUN_TEST(test_prepare_tmpl(100, 8));
+	RUN_TEST(test_prepare_tmpl(100, 8));
+	RUN_TEST(test_cache_budget(8000, 4));
 	std::puts("");
 	RUN_TEST(test_noarr_scalar());
 	RUN_TEST(test_noarr_vector());
@@ -157,6 +515,8 @@ int main() {
 	RUN_TEST(test_noarr_rmatrix());
 	std::puts("");
 	RUN_TEST(test_noarr_szvector());
+	RUN_TEST(test_noarr_prepare());
+	RUN_TEST(test_fuse(1800, 1900));
 	std::puts("");
 	return GLOBAL_failed;
 }